@@ -23,7 +23,7 @@ layout(std430, binding = 4) buffer ProgramBuffer {
             );
 
             programBuffer.color = 100;
-            set_drawcommand(0, 3, 1, 0, 0, 0);
+            set_drawcommand(2, 0, 3, 1, 0, 0, 0);
         }
     #endif
 #endif
@@ -1,3 +1,4 @@
 #pragma PARAM HEIGHT 400;
 #pragma PARAM WIDTH 400;
 #pragma PARAM TITLE "Demo Application";
+#pragma PARAM ON_DEMAND;
@@ -21,7 +21,7 @@ layout(std430, binding = 3) buffer VertexBuffer {
                 -0.5f, -0.5f, 0.0f
             );
 
-            set_drawcommand(0, 3, 1, 0, 0, 0);
+            set_drawcommand(1, 0, 3, 1, 0, 0, 0);
         }
     #endif
 #endif
@@ -27,7 +27,7 @@ layout(std430, binding = 4) buffer OtherBuffer {
                 -0.5f, -0.5f, 0.0f
             );
 
-            set_drawcommand(0, 3, 1, 0, 0, 0);
+            set_drawcommand(2, 0, 3, 1, 0, 0, 0);
 
             otherBuffer.rotation = 0;
             otherBuffer.positionX = 0;
@@ -34,10 +34,6 @@ void set_index(uint offset, uvec3 position) {
 
         void main() {
             //if(gl_NumWorkGroups.x == 1 && gl_LocalInvocationIndex == 0) {
-                workGroupBuffer.x = 4;
-                workGroupBuffer.y = 1;
-                workGroupBuffer.z = 1;
-
                 set_vertex(0, vec3( 1.0f,  1.0f, 0.0f));
                 set_vertex(1, vec3( 1.0f, -1.0f, 0.0f));
                 set_vertex(2, vec3(-1.0f, -1.0f, 0.0f));
@@ -46,13 +42,16 @@ void set_index(uint offset, uvec3 position) {
                 set_index(0, uvec3(0, 1, 3));
                 set_index(1, uvec3(1, 2, 3));
 
-                set_drawcommand(0, 6, 1, 0, 0, 0);
+                set_drawcommand(2, 0, 6, 1, 0, 0, 0);
+                set_drawcommand(3, 0, 6, 1, 0, 0, 0);
             //}
         }
     #endif
 #endif
 
 #ifdef PROGRAM_1
+    #pragma PROGRAM_1_PARAM DISPATCH 4;
+
     #ifdef PROGRAM_1_COMPUTE_SHADER
         layout(local_size_x = 16) in;
 
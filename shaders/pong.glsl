@@ -142,7 +142,7 @@ layout(std430, binding = 7) buffer Objects {
                 -0.5,  0.5, -0.5,  0.0,  1.0,  0.0
             );
 
-            set_drawcommand(0, 36, 8, 0, 0, 0);
+            set_drawcommand(2, 0, 36, 8, 0, 0, 0);
 
             game.ballVelocity = vec3(cos(radians(randInt(0, 360))), sin(radians(randInt(0, 360))), 0);
 
@@ -1,54 +1,1296 @@
 #include "engine.hpp"
 
+#include <mutex>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <thread>
+#include <algorithm>
 #include <regex>
 #include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
 #include <fstream>
-#include <sstream>
+#include <filesystem>
 #include <stdexcept>
 
 #include <GL/glew.h>
 
+#ifdef HEADLESS
+#include <EGL/eglext.h>
+#endif
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "parser.hpp"
 #include "program.hpp"
+#include "utils.hpp"
+
+Engine::Engine()
+{
+    this->verbose = true;
+
+    // Program binaries are cached in user cache directory by default
+    if(auto path = getenv("XDG_CACHE_HOME"); path != nullptr && *path != '\0')
+        this->cacheDirectory = std::string(path) + "/glsl-engine";
+    else if(auto path = getenv("HOME"); path != nullptr && *path != '\0')
+        this->cacheDirectory = std::string(path) + "/.cache/glsl-engine";
+}
+
+Engine::~Engine()
+{
+    this->destroy();
+}
+
+void Engine::init(std::string filename)
+{
+    if(this->isInitialized())
+        throw std::runtime_error("Context is already initialized");
+
+    if(!this->traceFilename.empty())
+        this->tracer.init();
+
+    auto source = Utils::readFile(filename);
+    this->filename = filename;
+
+    // Find all params and programs in one pass
+    auto traceBegin = this->tracer.now();
+    auto manifest = Parser::parse(source);
+    this->params = manifest.params;
+    this->tracer.record("parse", traceBegin);
+
+    if(this->params.contains("WIDTH"))
+        this->engineBuffer.width = stoi(this->params["WIDTH"]);
+
+    if(this->params.contains("HEIGHT"))
+        this->engineBuffer.height = stoi(this->params["HEIGHT"]);
+
+    // Packed input layout makes engine buffer a lot smaller
+    if(this->params.contains("PACKED_INPUT"))
+    {
+        this->isInputPacked = true;
+        this->engineBuffer.packedInput = {};
+        this->engineBufferSize = offsetof(EngineBuffer, packedInput) + sizeof(PackedInputState);
+    }
+
+    traceBegin = this->tracer.now();
+    if(this->headless)
+        this->createHeadlessContext();
+    else
+        this->createWindowContext();
+    this->tracer.record("create context", traceBegin);
+
+    if(this->tracer.isEnabled())
+        this->tracer.calibrate();
+
+    if(this->params.contains("ENABLE_DEPTH_TEST"))
+        glEnable(GL_DEPTH_TEST);
+    if(this->params.contains("ENABLE_STENCIL_TEST"))
+        glEnable(GL_STENCIL_TEST);
+    if(this->params.contains("ENABLE_CULL_FACE"))
+        glEnable(GL_CULL_FACE);
+
+    glViewport(0, 0, this->engineBuffer.width, this->engineBuffer.height);
+    
+    // CPU records next frames while GPU executes the older ones, up to FRAMES_IN_FLIGHT frames
+    if(this->params.contains("FRAMES_IN_FLIGHT"))
+        this->engineBufferSlots = stoi(this->params["FRAMES_IN_FLIGHT"]);
+
+    if(this->engineBufferSlots < 1 || this->engineBufferSlots > 8)
+        throw std::runtime_error("FRAMES_IN_FLIGHT must be between 1 and 8");
+
+    // Generate built-in buffers
+    // Engine buffer is updated every frame, so it is persistently mapped ring buffer with copy per frame in flight
+    GLint alignment;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    this->engineBufferSlotSize = (this->engineBufferSize + alignment - 1) / alignment * alignment;
+    this->engineBufferFences.assign(this->engineBufferSlots, nullptr);
+    this->engineBufferSubmitTimes.assign(this->engineBufferSlots, -1);
+    this->engineBufferDirtyRanges.assign(this->engineBufferSlots, {});
+    this->markDirty(&this->engineBuffer, this->engineBufferSize);
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &this->ebo); // Engine Buffer Object
+    glNamedBufferStorage(this->ebo, this->engineBufferSlotSize * this->engineBufferSlots, nullptr, flags);
+    this->engineBufferMapping = static_cast<char*>(glMapNamedBufferRange(this->ebo, 0, this->engineBufferSlotSize * this->engineBufferSlots, flags));
+
+    if(this->engineBufferMapping == nullptr)
+        throw std::runtime_error("Failed to map engine buffer");
+
+    if(this->params.contains("DRAW_COMMANDS"))
+        this->drawCommandCapacity = stoi(this->params["DRAW_COMMANDS"]);
+
+    if(this->drawCommandCapacity <= 0)
+        throw std::runtime_error("DRAW_COMMANDS must be positive");
+
+    if(this->params.contains("TARGET_FPS"))
+    {
+        auto fps = stod(this->params["TARGET_FPS"]);
+        if(fps <= 0)
+            throw std::runtime_error("TARGET_FPS must be positive");
+        this->targetFrameTime = this->batch ? 0 : 1.0 / fps;
+    }
+
+    // Draw programs render at lower resolution when GPU frame time exceeds the budget
+    if(this->params.contains("FRAME_BUDGET_MS"))
+    {
+        this->frameBudget = stod(this->params["FRAME_BUDGET_MS"]) * 1000;
+        if(this->frameBudget <= 0)
+            throw std::runtime_error("FRAME_BUDGET_MS must be positive");
+        this->createScaledFramebuffer();
+    }
+
+    // There are no input events in headless mode and batch runs do not wait for them, so every frame is rendered
+    this->isOnDemand = this->params.contains("ON_DEMAND") && !this->headless && !this->batch;
+
+    // Frame requests written by shaders are copied into a persistently mapped buffer, one flag per frame in flight
+    if(this->isOnDemand)
+    {
+        GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &this->requestBuffer);
+        glNamedBufferStorage(this->requestBuffer, sizeof(GLuint) * this->engineBufferSlots, nullptr, flags);
+        this->requestMapping = static_cast<GLuint*>(glMapNamedBufferRange(this->requestBuffer, 0, sizeof(GLuint) * this->engineBufferSlots, flags));
+        this->requestPending.assign(this->engineBufferSlots, false);
+
+        if(this->requestMapping == nullptr)
+            throw std::runtime_error("Failed to map request buffer");
+    }
+
+    // FIXED_STEP param is the rate of the simulation clock in Hz
+    if(this->params.contains("FIXED_STEP"))
+    {
+        auto rate = stod(this->params["FIXED_STEP"]);
+        if(rate <= 0)
+            throw std::runtime_error("FIXED_STEP must be positive");
+        this->fixedStep = 1.0 / rate;
+    }
+
+    size_t ranges = 0;
+    for(auto const& programManifest : manifest.programs)
+        ranges = std::max(ranges, static_cast<size_t>(programManifest.index) + 1);
+    this->reserveCommandRanges(ranges);
+
+    for(auto const& programManifest : manifest.programs)
+    {
+        auto program = new Program(this, programManifest.index);
+        program->params = programManifest.params;
+        this->programs.push_back(program);
+    }
+
+    // Prepare shader sources of all programs on all cores
+    std::atomic<size_t> next = 0;
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+    std::vector<std::thread> workers;
+
+    auto workerCount = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, this->programs.size() > 0 ? this->programs.size() : 1);
+    for(size_t i = 0; i < workerCount; i++)
+    {
+        workers.emplace_back([&]() {
+            for(size_t j; (j = next++) < this->programs.size();)
+            {
+                try {
+                    auto traceBegin = this->tracer.now();
+                    this->programs[j]->prepare(Parser::scope(source, manifest, manifest.programs[j].index), manifest.programs[j].stages);
+                    this->tracer.record("prepare PROGRAM", traceBegin, manifest.programs[j].index);
+                } catch(...) {
+                    std::lock_guard lock(exceptionMutex);
+                    exception = std::current_exception();
+                }
+            }
+        });
+    }
+
+    for(auto &worker : workers)
+        worker.join();
+
+    if(exception)
+        std::rethrow_exception(exception);
+
+    // Let the driver compile shaders on multiple threads if it is able to
+    if(GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if(GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+    // Submit all programs first, so driver can compile them while we wait for the first one
+    for(size_t i = 0; i < this->programs.size(); i++)
+    {
+        this->print("Compiling program %d\n", manifest.programs[i].index);
+        traceBegin = this->tracer.now();
+        this->programs[i]->submit();
+        this->tracer.record("submit PROGRAM", traceBegin, manifest.programs[i].index);
+    }
+
+    for(auto program : this->programs)
+    {
+        traceBegin = this->tracer.now();
+        program->finish(manifest.access);
+        this->tracer.record("finish PROGRAM", traceBegin, program->getIndex());
+    }
+
+    if(this->watch)
+        this->watchFile();
+
+    // BENCHMARK param optionally specifies number of frames between reports
+    if(this->params.contains("BENCHMARK") && !this->params["BENCHMARK"].empty())
+        this->benchmarkInterval = stol(this->params["BENCHMARK"]);
+
+    // PIPELINE_STATS param counts shader invocations and primitives of every program
+    auto isPipelineStatistics = this->params.contains("PIPELINE_STATS");
+    if(isPipelineStatistics && !GLEW_ARB_pipeline_statistics_query)
+    {
+        this->print("Pipeline statistics queries are not supported, PIPELINE_STATS is ignored\n");
+        isPipelineStatistics = false;
+    }
+
+    // GPU spans of the trace are measured by profiler
+    // Query ring has to be deeper than frames in flight, otherwise results are not available when read
+    if(this->params.contains("BENCHMARK") || this->tracer.isEnabled() || isPipelineStatistics || this->frameBudget > 0)
+        this->profiler.init(std::max(4, this->engineBufferSlots + 1), 1024, isPipelineStatistics);
+    if(this->tracer.isEnabled())
+        this->profiler.tracer = &this->tracer;
+
+    this->bakeCommands();
+}
+
+void Engine::update()
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto frameTraceBegin = this->tracer.now();
+
+    if(!this->isInitialized())
+        throw std::runtime_error("Context is not initialized");
+
+    if(this->isOnDemand)
+        this->waitForRequest();
+
+    if(this->isFileChanged())
+        this->reload();
+
+    if(this->isScreenResized)
+        this->resizeScreenTextures();
+
+    if(this->frameBudget > 0)
+        this->updateResolutionScale();
+
+    // Scaled framebuffer replaces the default one for draw programs
+    this->state.bindFramebuffer(this->scaledFramebuffer != 0 ? this->scaledFramebuffer : this->defaultFramebuffer);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Update time information, synthetic clock makes runs reproducible
+    if(this->fixedDeltaTime > 0)
+        engineBuffer.currentTime = lastFrameTime + this->fixedDeltaTime;
+    else
+        engineBuffer.currentTime = this->getTime();
+    engineBuffer.deltaTime = engineBuffer.currentTime - lastFrameTime;
+    lastFrameTime = engineBuffer.currentTime;
+
+    // Time fields are adjacent, so they are uploaded as a single range
+    this->markDirty(&engineBuffer.currentTime, sizeof(engineBuffer.currentTime) + sizeof(engineBuffer.deltaTime));
+
+    // Simulation advances by whole steps, rendering can interpolate by the remaining fraction
+    if(this->fixedStep > 0)
+    {
+        this->stepAccumulator += engineBuffer.deltaTime;
+        this->fixedSteps = static_cast<GLuint>(this->stepAccumulator / this->fixedStep);
+        this->stepAccumulator -= this->fixedSteps * this->fixedStep;
+
+        if(this->fixedSteps > maxFixedSteps)
+            this->fixedSteps = maxFixedSteps;
+
+        engineBuffer.stepAlpha = this->stepAccumulator / this->fixedStep;
+        this->markDirty(&engineBuffer.stepAlpha, sizeof(engineBuffer.stepAlpha));
+    }
+
+    auto isProfiled = this->profiler.isEnabled();
+
+    auto traceBegin = this->tracer.now();
+    this->waitForSlot(isProfiled);
+    this->tracer.record("wait for frame", traceBegin);
+
+    traceBegin = this->tracer.now();
+    this->uploadEngineBuffer();
+    this->tracer.record("upload", traceBegin);
+
+    if(isProfiled)
+        this->profiler.beginFrame();
+
+    bool isRetired = false;
+    for(auto &command : this->commands)
+    {
+        auto runs = this->scheduleCommand(command);
+        if(runs == 0)
+            continue;
+
+        traceBegin = this->tracer.now();
+
+        if(command.barriers != 0)
+            glMemoryBarrier(command.barriers);
+
+        // Disabled command still runs, but with zero work groups or draws
+        if(command.predicateBuffer != 0)
+            this->runPredicate(command);
+
+        this->state.useProgram(command.programId);
+        this->bindCommandBuffers(command);
+
+        // Uniforms are assigned to units when program is linked
+        for(auto i = command.texturesBegin; i < command.texturesEnd; i++)
+        {
+            auto const& [texture, type, unit, access] = this->commandTextures[i];
+
+            if(type == GL_IMAGE_2D)
+                this->state.bindImageTexture(unit, texture, access, GL_RGBA8);
+            else if(type == GL_SAMPLER_2D)
+                this->state.bindTextureUnit(unit, texture);
+        }
+
+        if(isProfiled)
+            this->profiler.beginProgram(command.index);
+
+        if(command.type == CommandType::Dispatch)
+        {
+            // Dispatch size of predicated command is copied into its pbo range
+            if(command.predicateBuffer != 0)
+                glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->pbo);
+
+            for(GLuint i = 0; i < command.iterations * runs; i++)
+            {
+                if(i > 0 && command.iterationBarriers != 0)
+                    glMemoryBarrier(command.iterationBarriers);
+
+                // Predicate copies the work group count, so it runs again to let iterations read the current one
+                if(i > 0 && command.predicateBuffer != 0)
+                {
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                    this->runPredicate(command);
+                    this->state.useProgram(command.programId);
+                    this->bindCommandBuffers(command);
+                }
+
+                if(command.iterationLocation != -1)
+                    glProgramUniform1ui(command.programId, command.iterationLocation, i);
+
+                // Indirect arguments are read again by every iteration
+                if(command.predicateBuffer != 0)
+                    glDispatchComputeIndirect(command.index * 4 * sizeof(unsigned int));
+                else if(command.dispatchSize[0] != 0)
+                    glDispatchCompute(command.dispatchSize[0], command.dispatchSize[1], command.dispatchSize[2]);
+                else
+                    glDispatchComputeIndirect(command.indirectOffset);
+            }
+
+            if(command.predicateBuffer != 0)
+                glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->wgbo);
+        }
+        else
+        {
+            this->state.bindVertexArray(command.varray);
+            this->state.bindFramebuffer(command.framebuffer);
+
+            // Custom framebuffers are rendered at the size of their attachments, only the scaled one at lower resolution
+            if(command.viewportWidth != 0)
+                this->state.setViewport(command.viewportWidth, command.viewportHeight);
+            else
+            {
+                auto scale = command.framebuffer == this->scaledFramebuffer ? this->engineBuffer.resolutionScale : 1.0f;
+                this->state.setViewport(this->engineBuffer.width * scale, this->engineBuffer.height * scale);
+            }
+
+            // Commands follow the draw count, only as many as shaders wrote are executed
+            auto offset = reinterpret_cast<const void*>(command.indirectOffset);
+            auto stride = 5 * sizeof(unsigned int);
+            auto drawCountOffset = command.drawCountOffset;
+
+            // Draw count of predicated command is copied into its pbo range
+            if(command.predicateBuffer != 0)
+            {
+                glBindBuffer(GL_PARAMETER_BUFFER, this->pbo);
+                drawCountOffset = (command.index * 4 + 3) * sizeof(unsigned int);
+            }
+
+            if(command.type == CommandType::DrawElements)
+                glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, offset, drawCountOffset, this->drawCommandCapacity, stride);
+            else
+                glMultiDrawArraysIndirectCount(GL_TRIANGLES, offset, drawCountOffset, this->drawCommandCapacity, stride);
+
+            if(command.predicateBuffer != 0)
+                glBindBuffer(GL_PARAMETER_BUFFER, this->dcbo);
+        }
+
+        if(isProfiled)
+            this->profiler.endProgram();
+
+        this->tracer.record("PROGRAM", traceBegin, command.index);
+
+        if(command.isRanOnce)
+        {
+            command.program->isIgnored = true;
+            isRetired = true;
+        }
+    }
+
+    // Command list changes only when some program is retired, barriers of the new list
+    // do not account for writes of retired programs so make everything visible once
+    if(isRetired)
+    {
+        glMemoryBarrier(GL_ALL_BARRIER_BITS);
+        this->bakeCommands();
+    }
+
+    // Edge bits are valid only for a single frame
+    if(this->isInputPacked)
+    {
+        auto &input = this->engineBuffer.packedInput;
+        if(input.btnEdgeBits != 0)
+            this->markDirty(&input.btnEdgeBits, sizeof(input.btnEdgeBits));
+        for(auto &bits : input.keyEdgeBits)
+            if(bits != 0)
+                this->markDirty(&bits, sizeof(bits));
+
+        input.btnEdgeBits = 0;
+        std::fill(std::begin(input.keyEdgeBits), std::end(input.keyEdgeBits), 0);
+    }
+
+    // Upscale rendered part of the scaled framebuffer to the whole default framebuffer
+    if(this->scaledFramebuffer != 0)
+    {
+        auto width = this->engineBuffer.width, height = this->engineBuffer.height;
+        auto scale = this->engineBuffer.resolutionScale;
+        glBlitNamedFramebuffer(this->scaledFramebuffer, this->defaultFramebuffer, 0, 0, width * scale, height * scale, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
+
+    // Frame request written by shaders is copied out and reset on GPU, CPU reads it once the frame's fence signals
+    if(this->isOnDemand)
+    {
+        GLuint zero = 0;
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glCopyNamedBufferSubData(this->wgbo, this->requestBuffer, 0, sizeof(GLuint) * this->engineBufferSlot, sizeof(GLuint));
+        glClearNamedBufferSubData(this->wgbo, GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        this->requestPending[this->engineBufferSlot] = true;
+    }
+
+    // Slot of the engine buffer can be reused once GPU finishes this frame
+    this->engineBufferFences[this->engineBufferSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    this->engineBufferSubmitTimes[this->engineBufferSlot] = this->getTime();
+    this->engineBufferSlot = (this->engineBufferSlot + 1) % this->engineBufferSlots;
+    
+    // There is nothing to present in headless mode, just submit the frame
+    if(this->headless)
+    {
+        glFlush();
+    }
+    else
+    {
+        traceBegin = this->tracer.now();
+        glfwPollEvents();
+        this->tracer.record("poll events", traceBegin);
+
+        traceBegin = this->tracer.now();
+        glfwSwapBuffers(this->context);
+        this->tracer.record("swap", traceBegin);
+    }
+
+    auto stopTime = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration<double, std::micro>(stopTime - startTime);
+    this->frameCount++;
+    this->tracer.record("frame", frameTraceBegin);
+
+    if(isProfiled)
+    {
+        this->profiler.endFrame(duration.count());
+
+        if(this->benchmarkInterval > 0 && this->frameCount % this->benchmarkInterval == 0)
+            this->print("%s", this->profiler.report().c_str());
+    }
+
+    traceBegin = this->tracer.now();
+    if(this->targetFrameTime > 0)
+        this->paceFrame();
+    this->tracer.record("pace", traceBegin);
+}
+
+void Engine::watchFile()
+{
+#ifdef __linux__
+    // Editors often replace the file instead of writing it, so the directory is watched
+    auto path = std::filesystem::absolute(this->filename);
+    this->watchedName = path.filename().string();
+
+    this->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(this->inotify < 0 || inotify_add_watch(this->inotify, path.parent_path().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        throw std::runtime_error("Failed to watch shader file");
+
+    this->print("Watching %s for changes\n", path.c_str());
+#else
+    throw std::runtime_error("Watching shader file is supported only on Linux");
+#endif
+}
+
+bool Engine::isFileChanged()
+{
+    if(this->inotify < 0)
+        return false;
+
+    bool isChanged = false;
+
+#ifdef __linux__
+    alignas(inotify_event) char events[4096];
+
+    ssize_t length;
+    while((length = read(this->inotify, events, sizeof(events))) > 0)
+    {
+        for(ssize_t i = 0; i < length;)
+        {
+            auto event = reinterpret_cast<inotify_event*>(events + i);
+            if(event->len > 0 && this->watchedName == event->name)
+                isChanged = true;
+
+            i += sizeof(inotify_event) + event->len;
+        }
+    }
+#endif
+
+    return isChanged;
+}
+
+void Engine::reload()
+{
+    std::string source;
+
+    try {
+        source = Utils::readFile(this->filename);
+    } catch(const std::exception& e) {
+        this->print("Failed to reload shader file: %s\n", e.what());
+        return;
+    }
+
+    // Global params are applied only when engine is initialized
+    auto manifest = Parser::parse(source);
+
+    size_t ranges = this->commandRanges;
+    for(auto const& programManifest : manifest.programs)
+        ranges = std::max(ranges, static_cast<size_t>(programManifest.index) + 1);
+    this->reserveCommandRanges(ranges);
+
+    std::vector<Program*> programs;
+    for(auto const& programManifest : manifest.programs)
+    {
+        auto current = std::find_if(this->programs.begin(), this->programs.end(), [&](auto program) {
+            return program->getIndex() == programManifest.index;
+        });
+
+        auto program = new Program(this, programManifest.index);
+        program->params = programManifest.params;
+
+        try {
+            program->prepare(Parser::scope(source, manifest, programManifest.index), programManifest.stages);
+
+            // Unchanged program is kept, including its retired state
+            if(current != this->programs.end() && (*current)->getSourceHash() == program->getSourceHash() && (*current)->params == program->params)
+            {
+                delete program;
+                programs.push_back(*current);
+                continue;
+            }
+
+            this->print("Recompiling program %d\n", programManifest.index);
+            program->submit();
+            program->finish(manifest.access);
+            programs.push_back(program);
+        } catch(const std::exception& e) {
+            // Keep running the old program if the new one is broken
+            this->print("Failed to reload program %d: %s\n", programManifest.index, e.what());
+            delete program;
+
+            if(current != this->programs.end())
+                programs.push_back(*current);
+        }
+    }
+
+    for(auto program : this->programs)
+        if(std::find(programs.begin(), programs.end(), program) == programs.end())
+            delete program;
+
+    // Deleted programs might still be shadowed by the state cache
+    this->programs = programs;
+    this->state.reset();
+    glMemoryBarrier(GL_ALL_BARRIER_BITS);
+    this->bakeCommands();
+}
+
+void Engine::bakeCommands()
+{
+    // Programs kept by the reload keep their RATE schedule, programs are only used as keys
+    std::map<Program*, double> lastRunTimes;
+    for(auto const& command : this->commands)
+        lastRunTimes[command.program] = command.lastRunTime;
+
+    this->commands.clear();
+    this->commandBuffers.clear();
+    this->commandTextures.clear();
+
+    for(auto program : this->programs)
+    {
+        if(program->isIgnored)
+            continue;
+
+        Command command;
+        command.program = program;
+        command.index = program->getIndex();
+        command.programId = program->getProgramId();
+        command.isRanOnce = program->isRanOnce;
+        command.every = program->every;
+        command.period = program->period;
+        command.isFixedStep = program->isFixedStep;
+        command.isScheduled = command.every > 1 || command.period > 0 || command.isFixedStep;
+        if(lastRunTimes.contains(program))
+            command.lastRunTime = lastRunTimes[program];
+        std::tie(command.predicateBuffer, command.predicateOffset) = program->getPredicate();
+
+        if(command.predicateBuffer != 0 && this->predicateProgram == 0)
+            this->predicateProgram = Program::createPredicateProgram();
+
+        command.buffersBegin = this->commandBuffers.size();
+        for(auto const& [buffer, point, access] : program->buffers)
+            this->commandBuffers.push_back(std::make_tuple(buffer, point));
+        command.buffersEnd = this->commandBuffers.size();
+
+        command.texturesBegin = this->commandTextures.size();
+        for(auto const& texture : program->textures)
+            this->commandTextures.push_back(texture);
+        command.texturesEnd = this->commandTextures.size();
+
+        if(program->isCompute())
+        {
+            command.type = CommandType::Dispatch;
+            command.indirectOffset = (1 + command.index * 3) * sizeof(unsigned int);
+            std::copy_n(program->getDispatchSize(), 3, command.dispatchSize);
+            command.iterations = program->getIterations();
+            command.iterationLocation = program->getIterationLocation();
+        }
+        else
+        {
+            command.type = program->params.contains("EBO") ? CommandType::DrawElements : CommandType::DrawArrays;
+            command.drawCountOffset = command.index * this->getDrawCommandRangeSize();
+            command.indirectOffset = command.drawCountOffset + sizeof(unsigned int);
+            command.varray = program->getVertexArrayId();
+            command.framebuffer = program->getFramebufferId() != 0 ? program->getFramebufferId() : this->defaultFramebuffer;
+            if(program->getFramebufferId() == 0 && this->scaledFramebuffer != 0)
+                command.framebuffer = this->scaledFramebuffer;
+
+            // All attachments of the custom framebuffer have the same size
+            if(program->getFramebufferId() != 0 && !program->outputs.empty())
+            {
+                glGetTextureLevelParameteriv(program->outputs.front(), 0, GL_TEXTURE_WIDTH, &command.viewportWidth);
+                glGetTextureLevelParameteriv(program->outputs.front(), 0, GL_TEXTURE_HEIGHT, &command.viewportHeight);
+            }
+        }
+
+        this->commands.push_back(command);
+    }
+
+    this->computeBarriers();
+}
+
+void Engine::computeBarriers()
+{
+    // Resource (texture flag and ID), whether the command writes it incoherently
+    // and barrier bit required before the command accesses data written by shaders
+    using Access = std::tuple<bool, GLuint, bool, GLbitfield>;
+
+    std::vector<std::vector<Access>> accesses;
+    for(auto const& command : this->commands)
+    {
+        auto program = command.program;
+        auto &access = accesses.emplace_back();
+
+        for(auto const& [buffer, point, mode] : program->buffers)
+            access.push_back(std::make_tuple(false, buffer, mode != GL_READ_ONLY, GL_SHADER_STORAGE_BARRIER_BIT));
+
+        for(auto const& [texture, type, unit, mode] : program->textures)
+        {
+            if(type == GL_IMAGE_2D)
+                access.push_back(std::make_tuple(true, texture, mode != GL_READ_ONLY, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+            else
+                access.push_back(std::make_tuple(true, texture, false, GL_TEXTURE_FETCH_BARRIER_BIT));
+        }
+
+        // Framebuffer writes are coherent, but image stores into attachments are not
+        for(auto texture : program->outputs)
+            access.push_back(std::make_tuple(true, texture, false, GL_FRAMEBUFFER_BARRIER_BIT));
+
+        for(auto const& [name, mode] : program->builtinBuffers)
+        {
+            auto buffer = name == "WorkGroupBuffer" ? this->wgbo : this->dcbo;
+            access.push_back(std::make_tuple(false, buffer, mode != GL_READ_ONLY, GL_SHADER_STORAGE_BARRIER_BIT));
+        }
+
+        // Predicate program reads the enabling value and indirect arguments before the command,
+        // it is followed by its own command barrier
+        if(command.predicateBuffer != 0)
+        {
+            access.push_back(std::make_tuple(false, command.predicateBuffer, false, GL_SHADER_STORAGE_BARRIER_BIT));
+            access.push_back(std::make_tuple(false, this->wgbo, false, GL_SHADER_STORAGE_BARRIER_BIT));
+            access.push_back(std::make_tuple(false, this->dcbo, false, GL_SHADER_STORAGE_BARRIER_BIT));
+        }
+
+        // Fixed function reads of buffers written by shaders, direct dispatch reads nothing
+        if(command.type == CommandType::Dispatch)
+        {
+            if(command.dispatchSize[0] == 0 && command.predicateBuffer == 0)
+                access.push_back(std::make_tuple(false, this->wgbo, false, GL_COMMAND_BARRIER_BIT));
+        }
+        else
+        {
+            access.push_back(std::make_tuple(false, this->dcbo, false, GL_COMMAND_BARRIER_BIT));
+            access.push_back(std::make_tuple(false, this->buffers[program->params["VBO"]], false, GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT));
+
+            if(command.type == CommandType::DrawElements)
+                access.push_back(std::make_tuple(false, this->buffers[program->params["EBO"]], false, GL_ELEMENT_ARRAY_BARRIER_BIT));
+        }
+    }
+
+    // Simulate the frame loop, each written resource remembers barrier bits issued since the write.
+    // Frames repeat, so writes at the end of a frame are consumed by the start of the next one,
+    // repeat until barriers do not change
+    std::map<std::tuple<bool, GLuint>, GLbitfield> written;
+    for(int pass = 0; pass < 4; pass++)
+    {
+        bool isChanged = false;
+
+        for(size_t i = 0; i < this->commands.size(); i++)
+        {
+            GLbitfield barriers = 0;
+            for(auto const& [isTexture, id, isWrite, bit] : accesses[i])
+            {
+                auto it = written.find(std::make_tuple(isTexture, id));
+                if(it != written.end() && (it->second & bit) == 0)
+                    barriers |= bit;
+            }
+
+            // Barriers of commands skipped in some frames cannot be relied on by other commands
+            if(!this->commands[i].isScheduled)
+            {
+                for(auto &[resource, visible] : written)
+                    visible |= barriers;
+            }
+
+            // Iterations of the command read what the previous iteration wrote
+            GLbitfield iterationBarriers = 0;
+            if(this->commands[i].iterations > 1 || this->commands[i].isFixedStep)
+            {
+                for(auto const& [isTexture, id, isWrite, bit] : accesses[i])
+                {
+                    for(auto const& [otherIsTexture, otherId, otherIsWrite, otherBit] : accesses[i])
+                        if(otherIsWrite && otherIsTexture == isTexture && otherId == id)
+                            iterationBarriers |= bit;
+                }
+
+                if(!this->commands[i].isScheduled)
+                {
+                    for(auto &[resource, visible] : written)
+                        visible |= iterationBarriers;
+                }
+            }
+
+            for(auto const& [isTexture, id, isWrite, bit] : accesses[i])
+                if(isWrite)
+                    written[std::make_tuple(isTexture, id)] = 0;
+
+            isChanged |= this->commands[i].barriers != barriers;
+            this->commands[i].barriers = barriers;
+            this->commands[i].iterationBarriers = iterationBarriers;
+        }
+
+        if(pass > 0 && !isChanged)
+            break;
+    }
+}
+
+void Engine::destroy()
+{
+    if(!this->isInitialized())
+        return;
+
+    if(this->profiler.isEnabled())
+    {
+        this->profiler.flush();
+        if(this->params.contains("BENCHMARK") || this->params.contains("PIPELINE_STATS"))
+            this->print("%s", this->profiler.report().c_str());
+        this->profiler.destroy();
+        this->profiler.tracer = nullptr;
+    }
+
+    if(this->tracer.isEnabled())
+    {
+        try {
+            this->tracer.write(this->traceFilename);
+            this->print("Trace written to %s\n", this->traceFilename.c_str());
+        } catch(const std::exception& e) {
+            this->print("%s\n", e.what());
+        }
+
+        this->tracer.destroy();
+    }
+
+    for(auto program : this->programs)        
+        delete program;
+
+    for(auto const& [name, buffer] : this->buffers)
+        glDeleteBuffers(1, &buffer);
+
+    for(auto const& [name, id] : this->textures)
+        glDeleteTextures(1, &id);
+
+    for(auto fence : this->engineBufferFences)
+        glDeleteSync(fence);
+
+    glUnmapNamedBuffer(this->ebo);
+    glDeleteBuffers(1, &this->ebo);
+    glDeleteBuffers(1, &this->wgbo);
+    glDeleteBuffers(1, &this->dcbo);
+    glDeleteBuffers(1, &this->pbo);
+
+    if(this->requestBuffer != 0)
+    {
+        glUnmapNamedBuffer(this->requestBuffer);
+        glDeleteBuffers(1, &this->requestBuffer);
+    }
+
+    if(this->predicateProgram != 0)
+        glDeleteProgram(this->predicateProgram);
+
+    if(this->scaledFramebuffer != 0)
+    {
+        glDeleteFramebuffers(1, &this->scaledFramebuffer);
+        glDeleteRenderbuffers(2, this->scaledRenderbuffers);
+    }
+
+    if(this->headless)
+    {
+        glDeleteFramebuffers(1, &this->defaultFramebuffer);
+        glDeleteRenderbuffers(2, this->renderbuffers);
+
+#ifdef HEADLESS
+        eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(this->headlessSurface != EGL_NO_SURFACE)
+            eglDestroySurface(this->display, this->headlessSurface);
+        eglDestroyContext(this->display, this->headlessContext);
+        eglTerminate(this->display);
+#endif
+    }
+    else
+    {
+        glfwDestroyWindow(this->context);
+        glfwTerminate();
+    }
+
+#ifdef __linux__
+    if(this->inotify >= 0)
+        close(this->inotify);
+#endif
+
+    this->inotify = -1;
+    this->context = nullptr;
+#ifdef HEADLESS
+    this->display = EGL_NO_DISPLAY;
+    this->headlessContext = EGL_NO_CONTEXT;
+    this->headlessSurface = EGL_NO_SURFACE;
+#endif
+    this->defaultFramebuffer = 0;
+    this->engineBufferMapping = nullptr;
+    this->engineBufferFences.clear();
+    this->engineBufferSubmitTimes.clear();
+    this->engineBufferSlots = 3;
+    this->engineBufferDirtyRanges.clear();
+    this->engineBufferSlot = 0;
+    this->programs.clear();
+    this->commands.clear();
+    this->commandBuffers.clear();
+    this->commandTextures.clear();
+    this->buffers.clear();
+    this->bufferSizes.clear();
+    this->textures.clear();
+    this->params.clear();
+    this->lastFrameTime = 0;
+    this->frameCount = 0;
+    this->benchmarkInterval = 0;
+    this->drawCommandCapacity = 100;
+    this->isScreenResized = false;
+    this->frameBudget = 0;
+    this->scaledFramebuffer = 0;
+    this->scaledRenderbuffers[0] = this->scaledRenderbuffers[1] = 0;
+    this->targetFrameTime = 0;
+    this->frameDeadline = 0;
+    this->isOnDemand = false;
+    this->isFrameRequested = true;
+    this->requestBuffer = 0;
+    this->requestMapping = nullptr;
+    this->requestPending.clear();
+    this->wasFrameRequested = false;
+    this->fixedStep = 0;
+    this->stepAccumulator = 0;
+    this->fixedSteps = 0;
+    this->commandRanges = 0;
+    this->wgbo = 0;
+    this->dcbo = 0;
+    this->pbo = 0;
+    this->predicateProgram = 0;
+    this->engineBuffer = {};
+    this->state.reset();
+    this->engineBufferSize = sizeof(EngineBuffer);
+    this->isInputPacked = false;
+}
+
+void Engine::createScaledFramebuffer()
+{
+    auto width = std::max(this->engineBuffer.width, 1), height = std::max(this->engineBuffer.height, 1);
+
+    if(this->scaledFramebuffer == 0)
+    {
+        glCreateRenderbuffers(2, this->scaledRenderbuffers);
+        glCreateFramebuffers(1, &this->scaledFramebuffer);
+    }
+
+    // Renderbuffers keep full resolution, scale only changes rendered area so it never reallocates
+    glNamedRenderbufferStorage(this->scaledRenderbuffers[0], GL_RGBA8, width, height);
+    glNamedRenderbufferStorage(this->scaledRenderbuffers[1], GL_DEPTH24_STENCIL8, width, height);
+    glNamedFramebufferRenderbuffer(this->scaledFramebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->scaledRenderbuffers[0]);
+    glNamedFramebufferRenderbuffer(this->scaledFramebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->scaledRenderbuffers[1]);
+
+    if(glCheckNamedFramebufferStatus(this->scaledFramebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Failed to create scaled framebuffer");
+}
+
+void Engine::updateResolutionScale()
+{
+    // GPU time is read back a few frames later, so only new measurements are used
+    auto times = this->profiler.takeGpuProgramTimes();
+
+    // Resolution affects only draws into the scaled framebuffer, compute dispatches would never get faster
+    double gpuTime = 0;
+    for(auto const& command : this->commands)
+        if(command.framebuffer == this->scaledFramebuffer && times.contains(command.index))
+            gpuTime += times[command.index];
+
+    if(gpuTime <= 0)
+        return;
+
+    // Tolerate frames slightly under the budget, so the scale does not oscillate around it
+    auto scale = this->engineBuffer.resolutionScale;
+    if(gpuTime < this->frameBudget && gpuTime > this->frameBudget * 0.8)
+        return;
+
+    // Fragment work is proportional to the area, aim at 90 % of the budget and move there gradually
+    auto target = scale * std::sqrt(this->frameBudget * 0.9 / gpuTime);
+    scale = std::clamp(scale + (target - scale) * 0.5, 0.25, 1.0);
+
+    if(std::abs(scale - this->engineBuffer.resolutionScale) < 0.01)
+        return;
+
+    this->engineBuffer.resolutionScale = scale;
+    this->markDirty(&this->engineBuffer.resolutionScale, sizeof(this->engineBuffer.resolutionScale));
+}
+
+void Engine::paceFrame()
+{
+    auto deadline = this->frameDeadline + this->targetFrameTime;
+    auto now = this->getTime();
+
+    // Frame that is late restarts the pacing, so the next frames do not try to catch up
+    if(now >= deadline)
+    {
+        this->frameDeadline = now;
+        return;
+    }
+
+    // Sleep can overshoot by around a millisecond, so the rest is spent spinning
+    const double spinTime = 0.002;
+    if(deadline - now > spinTime)
+        std::this_thread::sleep_for(std::chrono::duration<double>(deadline - now - spinTime));
+
+    while(this->getTime() < deadline)
+        std::this_thread::yield();
+
+    this->frameDeadline = deadline;
+}
+
+void Engine::waitForRequest()
+{
+    // While the last finished frame requested another one, frames still in flight are expected to request too
+    auto isPending = this->readRequests();
+    if(isPending && this->wasFrameRequested)
+        this->isFrameRequested = true;
+
+    // Any event (input, resize, expose) renders next frame, watched file has no event so it is polled
+    while(!this->isFrameRequested && !glfwWindowShouldClose(this->context))
+    {
+        // Frames in flight may still request another one, events are polled until they finish
+        if(isPending)
+        {
+            glfwWaitEventsTimeout(0.001);
+            isPending = this->readRequests();
+            continue;
+        }
+
+        if(!this->watch)
+        {
+            glfwWaitEvents();
+            continue;
+        }
+
+        glfwWaitEventsTimeout(0.25);
+        if(this->isFileChanged())
+        {
+            this->reload();
+            break;
+        }
+    }
 
-Engine::Engine()
+    this->isFrameRequested = false;
+}
+
+bool Engine::readRequests()
 {
-    this->verbose = true;
+    // Frames finish in order and the oldest one uses the current slot
+    for(int i = 0; i < this->engineBufferSlots; i++)
+    {
+        auto slot = (this->engineBufferSlot + i) % this->engineBufferSlots;
+        if(!this->requestPending[slot])
+            continue;
+
+        auto fence = this->engineBufferFences[slot];
+        if(fence != nullptr && glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+            return true;
+
+        this->wasFrameRequested = this->requestMapping[slot] != 0;
+        this->isFrameRequested = this->isFrameRequested || this->wasFrameRequested;
+        this->requestPending[slot] = false;
+    }
+
+    return false;
 }
 
-Engine::~Engine()
+void Engine::runPredicate(const Command &command)
 {
-    this->destroy();
+    this->state.useProgram(this->predicateProgram);
+    this->state.bindStorageBuffer(3, command.predicateBuffer);
+    this->state.bindStorageBuffer(4, this->pbo);
+
+    auto drawCountOffset = command.drawCountOffset / sizeof(unsigned int);
+    glProgramUniform1ui(this->predicateProgram, 0, command.predicateOffset);
+    glProgramUniform1ui(this->predicateProgram, 1, command.index);
+    glProgramUniform1ui(this->predicateProgram, 2, drawCountOffset);
+    glProgramUniform3ui(this->predicateProgram, 3, command.dispatchSize[0], command.dispatchSize[1], command.dispatchSize[2]);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
 }
 
-void Engine::init(std::string filename)
+void Engine::bindCommandBuffers(const Command &command)
 {
-    if(this->context != nullptr)
-        throw std::runtime_error("Context is already initialized");
+    for(auto i = command.buffersBegin; i < command.buffersEnd; i++)
+        this->state.bindStorageBuffer(std::get<1>(this->commandBuffers[i]), std::get<0>(this->commandBuffers[i]));
+}
+
+GLuint Engine::scheduleCommand(Command &command)
+{
+    if(!command.isScheduled)
+        return 1;
+
+    if(command.isFixedStep)
+        return this->fixedSteps;
+
+    if(command.every > 1)
+        return this->frameCount % command.every == 0 ? 1 : 0;
+
+    auto time = this->engineBuffer.currentTime;
+    if(command.lastRunTime >= 0 && time - command.lastRunTime < command.period)
+        return 0;
+
+    // Runs keep the average rate, unless the command fell behind by more than a period
+    if(command.lastRunTime >= 0 && time - command.lastRunTime < 2 * command.period)
+        command.lastRunTime += command.period;
+    else
+        command.lastRunTime = time;
+
+    return 1;
+}
+
+GLsizei Engine::getDrawCommandCapacity()
+{
+    return this->drawCommandCapacity;
+}
+
+size_t Engine::getDrawCommandRangeSize()
+{
+    return (1 + this->drawCommandCapacity * 5) * sizeof(unsigned int);
+}
+
+void Engine::reserveCommandRanges(size_t ranges)
+{
+    // At least one range is allocated, so the frame request word exists even without programs
+    ranges = std::max<size_t>(ranges, 1);
+    if(ranges <= this->commandRanges)
+        return;
+
+    // Programs dispatch one work group until some shader sets their size, no frame is requested
+    std::vector<unsigned int> workGroups(1 + ranges * 3, 1);
+    workGroups[0] = 0;
+    GLuint wgbo;
+    glCreateBuffers(1, &wgbo); // Work Group Buffer Object
+    glNamedBufferData(wgbo, workGroups.size() * sizeof(unsigned int), workGroups.data(), GL_DYNAMIC_DRAW);
+
+    // Draw count is written by shaders and read by the driver from the same buffer
+    std::vector<unsigned char> drawCommands(ranges * this->getDrawCommandRangeSize(), 0);
+    GLuint dcbo;
+    glCreateBuffers(1, &dcbo); // Draw Command Buffer Object
+    glNamedBufferStorage(dcbo, drawCommands.size(), drawCommands.data(), 0);
+
+    if(this->commandRanges > 0)
+    {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glCopyNamedBufferSubData(this->wgbo, wgbo, 0, 0, (1 + this->commandRanges * 3) * sizeof(unsigned int));
+        glCopyNamedBufferSubData(this->dcbo, dcbo, 0, 0, this->commandRanges * this->getDrawCommandRangeSize());
+        glDeleteBuffers(1, &this->wgbo);
+        glDeleteBuffers(1, &this->dcbo);
+    }
+
+    this->wgbo = wgbo;
+    this->dcbo = dcbo;
+    this->commandRanges = ranges;
+
+    // Predicate results are written every frame before they are used, so their contents are not kept
+    if(this->pbo != 0)
+        glDeleteBuffers(1, &this->pbo);
+    glCreateBuffers(1, &this->pbo); // Predicate Buffer Object
+    glNamedBufferStorage(this->pbo, ranges * 4 * sizeof(unsigned int), nullptr, 0);
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->wgbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->wgbo);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->dcbo);
+    glBindBuffer(GL_PARAMETER_BUFFER, this->dcbo);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, this->dcbo);
+}
+
+void Engine::markDirty(const void *field, size_t size)
+{
+    auto begin = static_cast<size_t>(static_cast<const char*>(field) - reinterpret_cast<char*>(&this->engineBuffer));
 
-    std::ifstream stream(filename);
+    // Every slot of the ring buffer has to receive the change once
+    for(auto &ranges : this->engineBufferDirtyRanges)
+        ranges.push_back(std::make_pair(begin, begin + size));
+}
+
+void Engine::waitForSlot(bool isProfiled)
+{
+    auto &fence = this->engineBufferFences[this->engineBufferSlot];
+
+    // Wait until GPU stops reading the slot from the older frame
+    if(fence != nullptr)
+    {
+        auto waitBegin = this->getTime();
+
+        GLenum result;
+        while((result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)) == GL_TIMEOUT_EXPIRED);
 
-    if(stream.fail())
-        throw std::invalid_argument("Could not open specified shader file");
+        if(result == GL_WAIT_FAILED)
+            throw std::runtime_error("Failed to wait for engine buffer fence");
 
-    std::stringstream buffer;
-    buffer << stream.rdbuf();
+        if(isProfiled)
+            this->profiler.addSample(Profiler::frameWait, (this->getTime() - waitBegin) * 1000000);
+    }
 
-    // Find all global params
-    std::smatch match;
-    std::string haystack (buffer.str());
-    while(std::regex_search(haystack, match, std::regex("#pragma PARAM (\\S+)(?:\\s(?:(\\w+)|\\\"([^\"]*)\\\"))?;")))
+    // Latency is measured from submission until the completion is observed, other frames are only polled
+    auto now = this->getTime();
+    for(int i = 0; i < this->engineBufferSlots; i++)
     {
-        params[match.str(1)] = match[3].matched ? match.str(3) : match.str(2);
-        haystack = match.suffix();
+        auto &submitTime = this->engineBufferSubmitTimes[i];
+        if(this->engineBufferFences[i] == nullptr || submitTime < 0)
+            continue;
+
+        GLint status = GL_SIGNALED;
+        if(i != this->engineBufferSlot)
+            glGetSynciv(this->engineBufferFences[i], GL_SYNC_STATUS, 1, nullptr, &status);
+
+        if(status == GL_SIGNALED)
+        {
+            if(isProfiled)
+                this->profiler.addSample(Profiler::frameLatency, (now - submitTime) * 1000000);
+            submitTime = -1;
+        }
     }
 
-    if(this->params.contains("WIDTH"))
-        this->engineBuffer.width = stoi(this->params["WIDTH"]);
+    // Request flag of the finished frame is overwritten by this frame
+    if(this->isOnDemand)
+        this->readRequests();
 
-    if(this->params.contains("HEIGHT"))
-        this->engineBuffer.height = stoi(this->params["HEIGHT"]);
+    if(fence != nullptr)
+    {
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+void Engine::uploadEngineBuffer()
+{
+    auto offset = this->engineBufferSlot * this->engineBufferSlotSize;
+    auto &ranges = this->engineBufferDirtyRanges[this->engineBufferSlot];
+
+    // Coalesce overlapping and nearby ranges, copying small gaps is cheaper than extra copies
+    sort(ranges.begin(), ranges.end());
+
+    size_t begin = 0, end = 0;
+    for(auto const& [rangeBegin, rangeEnd] : ranges)
+    {
+        if(end != 0 && rangeBegin <= end + 32)
+        {
+            end = std::max(end, rangeEnd);
+            continue;
+        }
+
+        if(end != 0)
+            memcpy(this->engineBufferMapping + offset + begin, reinterpret_cast<char*>(&this->engineBuffer) + begin, end - begin);
+
+        begin = rangeBegin;
+        end = rangeEnd;
+    }
+
+    if(end != 0)
+        memcpy(this->engineBufferMapping + offset + begin, reinterpret_cast<char*>(&this->engineBuffer) + begin, end - begin);
+
+    ranges.clear();
+    this->state.bindStorageBuffer(0, this->ebo, offset, this->engineBufferSize);
+}
+
+void Engine::finish()
+{
+    if(!this->isInitialized())
+        throw std::runtime_error("Context is not initialized");
+
+    glFinish();
+}
+
+bool Engine::shouldClose()
+{
+    if(!this->isInitialized())
+        throw std::runtime_error("Context is not initialized");
+
+    // There is no window that could be closed in headless mode
+    if(this->headless)
+        return false;
+
+    return glfwWindowShouldClose(this->context);
+}
 
+void Engine::createWindowContext()
+{
     // Initialize GLFW
     if(glfwInit() == GLFW_FALSE)
         throw std::runtime_error("Failed to initialize GLFW");
@@ -64,7 +1306,11 @@ void Engine::init(std::string filename)
 
     glfwSetWindowUserPointer(this->context, this);
     glfwMakeContextCurrent(context);
-    glfwSwapInterval(0);
+    // VSYNC param optionally specifies number of screen updates per frame
+    auto interval = 0;
+    if(this->params.contains("VSYNC") && !this->batch)
+        interval = this->params["VSYNC"].empty() ? 1 : stoi(this->params["VSYNC"]);
+    glfwSwapInterval(interval);
 
     if(this->params.contains("CURSOR_DISABLED"))
         glfwSetInputMode(context, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -89,206 +1335,204 @@ void Engine::init(std::string filename)
         engine->mouse_btn_callback(context, button, action, mods);
     });
 
+    glfwSetWindowRefreshCallback(context, [](GLFWwindow *context) {
+        auto engine = static_cast<Engine*>(glfwGetWindowUserPointer(context));
+        engine->isFrameRequested = true;
+    });
+
     // Initialize OpenGL
     if(glewInit() != GLEW_OK)
         throw std::runtime_error("Failed to initialize OpenGL");
-
-    if(this->params.contains("ENABLE_DEPTH_TEST"))
-        glEnable(GL_DEPTH_TEST);
-    if(this->params.contains("ENABLE_STENCIL_TEST"))
-        glEnable(GL_STENCIL_TEST);
-    if(this->params.contains("ENABLE_CULL_FACE"))
-        glEnable(GL_CULL_FACE);
-
-    glViewport(0, 0, this->engineBuffer.width, this->engineBuffer.height);
-    
-    // Generate built-in buffers
-    glCreateBuffers(1, &this->ebo); // Engine Buffer Object
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->ebo);
-
-    int workGroups[3] = {1, 1, 1};
-    glCreateBuffers(1, &this->wgbo); // Work Group Buffer Object
-    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->wgbo);
-    glNamedBufferData(this->wgbo, sizeof(workGroups), &workGroups, GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->wgbo);
-
-    unsigned int drawCommands[100 * 5] = {0};
-    glCreateBuffers(1, &this->dcbo); // Draw Command Buffer Object
-    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->dcbo);
-    glNamedBufferStorage(this->dcbo, 100 * sizeof(unsigned int) * 5, &drawCommands, GL_MAP_WRITE_BIT);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, this->dcbo);
-
-    // Find all params of the program
-    haystack.assign(buffer.str());
-    while(std::regex_search(haystack, match, std::regex("#ifdef PROGRAM_(\\d+)\\s")))
-    {
-        auto id = stoi(match[1]);
-        this->print("Compiling program %zu\n", id);
-        auto program = new Program(this, id);
-
-        // Find all params of the program
-        std::string nhaystack (buffer.str());
-        std::smatch nmatch;
-        while(std::regex_search(nhaystack, nmatch, std::regex("#pragma PROGRAM_" + std::to_string(id) + + "_PARAM (\\S+)(?:\\s(?:(\\w+)|\\\"([^\"]*)\\\"))?;")))
-        {
-            program->params[nmatch.str(1)] = nmatch[3].matched ? nmatch.str(3) : nmatch.str(2);
-            nhaystack = nmatch.suffix();
-        }
-
-        program->compile(buffer.str());
-        this->programs.push_back(program);
-
-        haystack = match.suffix();
-    }
 }
 
-void Engine::update()
+void Engine::createHeadlessContext()
 {
-    auto startTime = std::chrono::high_resolution_clock::now();
-
-    if(this->context == nullptr)
-        throw std::runtime_error("Context is not initialized");
-
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Update time information
-    engineBuffer.currentTime = glfwGetTime();
-    engineBuffer.deltaTime = engineBuffer.currentTime - lastFrameTime;
-    lastFrameTime = engineBuffer.currentTime;
-
-    glNamedBufferData(this->ebo, sizeof(this->engineBuffer), &this->engineBuffer, GL_STATIC_READ);
-
-    for(auto program : this->programs)
+#ifndef HEADLESS
+    throw std::runtime_error("Headless mode is not available, engine was built without EGL");
+#else
+    // Prefer Mesa surfaceless platform, it does not need any display server or GPU device node
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(getPlatformDisplay != nullptr)
+        this->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if(this->display == EGL_NO_DISPLAY)
+        this->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    if(this->display == EGL_NO_DISPLAY || eglInitialize(this->display, nullptr, nullptr) == EGL_FALSE)
+        throw std::runtime_error("Failed to initialize EGL");
+
+    if(eglBindAPI(EGL_OPENGL_API) == EGL_FALSE)
+        throw std::runtime_error("Failed to bind OpenGL API to EGL");
+
+    EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint configCount = 0;
+    if(eglChooseConfig(this->display, configAttributes, &config, 1, &configCount) == EGL_FALSE || configCount == 0)
+        throw std::runtime_error("Failed to choose EGL config");
+
+    EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 6,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    this->headlessContext = eglCreateContext(this->display, config, EGL_NO_CONTEXT, contextAttributes);
+    if(this->headlessContext == EGL_NO_CONTEXT)
+        throw std::runtime_error("Failed to create EGL context");
+
+    // Fallback to pbuffer surface if surfaceless context is not supported
+    if(eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, this->headlessContext) == EGL_FALSE)
     {
-        if(program->isIgnored)
-            continue;
-
-        glUseProgram(program->getProgramId());
-
-        for(auto const& [buffer, point] : program->buffers)
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, point, buffer);
-
-        int i = 0;
-        for(auto const& [texture, type, location] : program->textures)
-        {
-            if(type == GL_IMAGE_2D)
-            {
-                glUniform1i(location, i);
-                glBindImageTexture(i, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
-            } 
-            else if(type == GL_SAMPLER_2D)
-            {
-                glUniform1i(location, i);
-                glBindTextureUnit(i, texture);
-            }
-                
-            i++;
-        }
-
-        if(program->isCompute() == true)
-        {
-            glDispatchComputeIndirect(0);
-            glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-        }
-        else
-        {
-            if(program->getVertexArrayId() != 0)
-                glBindVertexArray(program->getVertexArrayId());
+        EGLint surfaceAttributes[] = {
+            EGL_WIDTH, this->engineBuffer.width,
+            EGL_HEIGHT, this->engineBuffer.height,
+            EGL_NONE
+        };
+
+        this->headlessSurface = eglCreatePbufferSurface(this->display, config, surfaceAttributes);
+        if(this->headlessSurface == EGL_NO_SURFACE || 
+           eglMakeCurrent(this->display, this->headlessSurface, this->headlessSurface, this->headlessContext) == EGL_FALSE)
+            throw std::runtime_error("Failed to make EGL context current");
+    }
 
-            if(program->getFramebufferId() != 0)
-                glBindFramebuffer(GL_FRAMEBUFFER, program->getFramebufferId());
+    // Initialize OpenGL, glewInit would require GLX display so only load context functions
+    glewExperimental = GL_TRUE;
+    if(glewContextInit() != GLEW_OK)
+        throw std::runtime_error("Failed to initialize OpenGL");
 
-            if(program->params.contains("EBO"))
-                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 100, 0);
-            else
-                glMultiDrawArraysIndirect(GL_TRIANGLES, nullptr, 100, sizeof(unsigned int));
+    // Create offscreen framebuffer which replaces window framebuffer
+    glCreateRenderbuffers(2, this->renderbuffers);
+    glNamedRenderbufferStorage(this->renderbuffers[0], GL_RGBA8, this->engineBuffer.width, this->engineBuffer.height);
+    glNamedRenderbufferStorage(this->renderbuffers[1], GL_DEPTH24_STENCIL8, this->engineBuffer.width, this->engineBuffer.height);
 
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            glBindVertexArray(0);
-        }
+    glCreateFramebuffers(1, &this->defaultFramebuffer);
+    glNamedFramebufferRenderbuffer(this->defaultFramebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->renderbuffers[0]);
+    glNamedFramebufferRenderbuffer(this->defaultFramebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->renderbuffers[1]);
 
-        if(program->isRanOnce)
-            program->isIgnored = true;
-    }
-    
-    glfwPollEvents();
-    glfwSwapBuffers(this->context);
+    if(glCheckNamedFramebufferStatus(this->defaultFramebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("Failed to create offscreen framebuffer");
 
-    auto stopTime = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stopTime - startTime);
+    glBindFramebuffer(GL_FRAMEBUFFER, this->defaultFramebuffer);
 
-    if(this->params.contains("BENCHMARK"))
-        this->print("Last frame execution time: %d microseconds\n", duration);
+    this->startTime = 0;
+    this->startTime = this->getTime();
+    this->print("Running headless: %s\n", (const char *) glGetString(GL_RENDERER));
+#endif
 }
 
-void Engine::destroy()
+bool Engine::isInitialized()
 {
-    if(this->context == nullptr)
-        return;
-
-    for(auto program : this->programs)        
-        delete program;
-
-    for(auto const& [name, buffer] : this->buffers)
-        glDeleteBuffers(1, &buffer);
-
-    for(auto const& [name, id] : this->textures)
-        glDeleteTextures(1, &id);
-
-    glDeleteBuffers(1, &this->ebo);
-    glDeleteBuffers(1, &this->wgbo);
-    glDeleteBuffers(1, &this->dcbo);
-    
-    glfwDestroyWindow(this->context);
-    glfwTerminate();
-
-    this->context = nullptr;
-    this->programs.clear();
-    this->buffers.clear();
-    this->textures.clear();
-    this->params.clear();
-    this->lastFrameTime = 0;
-    this->engineBuffer = {};
+#ifdef HEADLESS
+    if(this->headlessContext != EGL_NO_CONTEXT)
+        return true;
+#endif
+    return this->context != nullptr;
 }
 
-bool Engine::shouldClose()
+double Engine::getTime()
 {
-    if(this->context == nullptr)
-        throw std::runtime_error("Context is not initialized");
+    if(!this->headless)
+        return glfwGetTime();
 
-    return glfwWindowShouldClose(this->context);
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(now).count() - this->startTime;
 }
 
 void Engine::key_callback(GLFWwindow *context, int key, int scancode, int action, int mods)
 {
+    if(key < 0 || key > GLFW_KEY_LAST)
+        return;
+
+    this->isFrameRequested = true;
+
+    if(this->isInputPacked)
+    {
+        auto &input = this->engineBuffer.packedInput;
+        auto bit = 1u << (key % 32);
+
+        if(action == 1)
+            input.keyEdgeBits[key / 32] |= bit;
+        if(action == 1 || action == 2)
+            input.keyBits[key / 32] |= bit;
+        else if(action == 0)
+            input.keyBits[key / 32] &= ~bit;
+
+        this->markDirty(&input.keyBits[key / 32], sizeof(unsigned int));
+        this->markDirty(&input.keyEdgeBits[key / 32], sizeof(unsigned int));
+        return;
+    }
+
+    if(key == GLFW_KEY_LAST)
+        return;
+
     if(action == 1 || action == 2)
-        this->engineBuffer.keyState[key] = 1;
+        this->engineBuffer.input.keyState[key] = 1;
     else if(action == 0)
-        this->engineBuffer.keyState[key] = 0;
+        this->engineBuffer.input.keyState[key] = 0;
+
+    this->markDirty(&this->engineBuffer.input.keyState[key], sizeof(int));
 }
 
 void Engine::size_callback(GLFWwindow *context, int width, int height)
 {
+    this->isFrameRequested = true;
     this->engineBuffer.width = width;
     this->engineBuffer.height = height;
-    glViewport(0, 0, width, height);
+    this->markDirty(&this->engineBuffer.width, sizeof(int) * 2);
+
+    // Screen relative textures are reallocated lazily, once per frame at most
+    this->isScreenResized = true;
+
+    if(this->scaledFramebuffer != 0)
+        this->createScaledFramebuffer();
 }
 
 void Engine::mouse_pos_callback(GLFWwindow *context, double xpos, double ypos)
 {
+    this->isFrameRequested = true;
     this->engineBuffer.mouseX = xpos;
     this->engineBuffer.mouseY = ypos;
+    this->markDirty(&this->engineBuffer.mouseX, sizeof(int) * 2);
 }
 
 void Engine::mouse_btn_callback(GLFWwindow *context, int button, int action, int mods)
 {
-    this->engineBuffer.btnState[button] = action;
+    if(button < 0 || button >= GLFW_MOUSE_BUTTON_LAST)
+        return;
+
+    this->isFrameRequested = true;
+
+    if(this->isInputPacked)
+    {
+        auto &input = this->engineBuffer.packedInput;
+
+        if(action == 1)
+        {
+            input.btnBits |= 1u << button;
+            input.btnEdgeBits |= 1u << button;
+        }
+        else
+        {
+            input.btnBits &= ~(1u << button);
+        }
+
+        // Both masks are adjacent
+        this->markDirty(&input.btnBits, sizeof(unsigned int) * 2);
+        return;
+    }
+
+    this->engineBuffer.input.btnState[button] = action;
+    this->markDirty(&this->engineBuffer.input.btnState[button], sizeof(int));
 }
 
 GLuint Engine::createTexture(std::string name)
 {
-    if(this->context == nullptr)
+    if(!this->isInitialized())
         throw std::runtime_error("Context is not initialized");
 
     if(this->textures.contains(name))
@@ -297,32 +1541,82 @@ GLuint Engine::createTexture(std::string name)
         return this->textures[name];
     }
 
-    std::cmatch match;
-    if(!std::regex_match(name.c_str(), match, std::regex("^\\S+_(\\d+)x(\\d+)$")))
-        throw std::runtime_error("Failed to generate texture, Reason: Invalid texture name");
+    auto [width, height, isScreenRelative] = this->getTextureSize(name);
     
     this->print("- Creating texture: %s\n", name.c_str());
 
     GLuint texture;
     glCreateTextures(GL_TEXTURE_2D, 1, &texture);
-    glTextureStorage2D(texture, 1, GL_RGBA8, stoi(match[1]), stoi(match[2]));
+    glTextureStorage2D(texture, 1, GL_RGBA8, width, height);
     
     this->textures[name] = texture;
     this->print("- Loaded texture: %s with ID: %d\n", name.c_str(), texture);
     return texture;
 }
 
-GLuint Engine::createBuffer(std::string name, int size)
+std::tuple<int, int, bool> Engine::getTextureSize(const std::string &name)
 {
-    if(this->context == nullptr)
-        throw std::runtime_error("Context is not initialized");
-    
-    if(this->buffers.contains(name))
+    std::cmatch match;
+    if(std::regex_match(name.c_str(), match, std::regex("^\\S+_(\\d+)x(\\d+)$")))
+        return std::make_tuple(stoi(match[1]), stoi(match[2]), false);
+
+    // Screen relative textures follow the window size, minimized window has zero size
+    if(!std::regex_match(name.c_str(), match, std::regex("^\\S+_(screen|half|quarter)$")))
+        throw std::runtime_error("Failed to generate texture, Reason: Invalid texture name");
+
+    auto divisor = match[1] == "screen" ? 1 : match[1] == "half" ? 2 : 4;
+    auto width = std::max(this->engineBuffer.width / divisor, 1);
+    auto height = std::max(this->engineBuffer.height / divisor, 1);
+    return std::make_tuple(width, height, true);
+}
+
+void Engine::resizeScreenTextures()
+{
+    this->isScreenResized = false;
+
+    // Immutable storage cannot be resized, so textures are replaced by new ones
+    std::map<GLuint, GLuint> replaced;
+    for(auto &[name, texture] : this->textures)
     {
-        this->print("- Loaded buffer %s with ID: %d\n", name.c_str(), this->buffers[name]);
-        return this->buffers[name];
+        auto [width, height, isScreenRelative] = this->getTextureSize(name);
+        if(!isScreenRelative)
+            continue;
+
+        GLint currentWidth, currentHeight;
+        glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &currentWidth);
+        glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &currentHeight);
+        if(currentWidth == width && currentHeight == height)
+            continue;
+
+        this->print("- Resizing texture %s to %dx%d\n", name.c_str(), width, height);
+
+        GLuint resized;
+        glCreateTextures(GL_TEXTURE_2D, 1, &resized);
+        glTextureStorage2D(resized, 1, GL_RGBA8, width, height);
+        replaced[texture] = resized;
+        texture = resized;
     }
 
+    if(replaced.empty())
+        return;
+
+    for(auto program : this->programs)
+        for(auto const& [texture, resized] : replaced)
+            program->replaceTexture(texture, resized);
+
+    for(auto const& [texture, resized] : replaced)
+        glDeleteTextures(1, &texture);
+
+    // Old textures might still be shadowed by the state cache, and commands hold their IDs
+    this->state.reset();
+    this->bakeCommands();
+}
+
+GLuint Engine::createBuffer(std::string name, int size)
+{
+    if(!this->isInitialized())
+        throw std::runtime_error("Context is not initialized");
+    
     std::cmatch match;
     if(!std::regex_match(name.c_str(), match, std::regex("^[a-zA-Z0-9]+(?:_(\\d+))?$")))
         throw std::runtime_error("Failed to generate buffer, Reason: Invalid buffer name");
@@ -330,6 +1624,20 @@ GLuint Engine::createBuffer(std::string name, int size)
     // If there is size specified in the buffer name, use that one instead of GLSL information
     size = match[1].matched ? stoi(match[1]) : size;
 
+    if(this->buffers.contains(name))
+    {
+        // Buffer keeps its contents unless some program needs it to be bigger
+        if(size > this->bufferSizes[name])
+        {
+            this->print("- Resizing buffer: %s (%db)\n", name.c_str(), size);
+            glNamedBufferData(this->buffers[name], size, NULL, GL_DYNAMIC_DRAW);
+            this->bufferSizes[name] = size;
+        }
+
+        this->print("- Loaded buffer %s with ID: %d\n", name.c_str(), this->buffers[name]);
+        return this->buffers[name];
+    }
+
     this->print("- Creating buffer: %s (%db)\n", name.c_str(), size);
 
     GLuint buffer;
@@ -337,6 +1645,7 @@ GLuint Engine::createBuffer(std::string name, int size)
     glNamedBufferData(buffer, size, NULL, GL_DYNAMIC_DRAW);
 
     this->buffers[name] = buffer;
+    this->bufferSizes[name] = size;
     this->print("- Loaded buffer: %s with ID: %d\n", name.c_str(), buffer);
     return buffer;
 }
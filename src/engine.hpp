@@ -2,17 +2,49 @@
 #define ENGINE_H
 
 #include <map>
+#include <tuple>
 #include <string>
 #include <vector>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#endif
+
 #include "program.hpp"
+#include "profiler.hpp"
+#include "state.hpp"
+#include "tracer.hpp"
 
 class Program;
 class Buffer;
 
+struct InputState
+{
+    //! State of mouse buttons
+    int btnState[GLFW_MOUSE_BUTTON_LAST] = {0};
+
+    //! State of keyboard button
+    int keyState[GLFW_KEY_LAST] = {0};
+};
+
+struct PackedInputState
+{
+    //! State of mouse buttons, one bit per button
+    unsigned int btnBits;
+
+    //! Mouse buttons pressed since the last frame
+    unsigned int btnEdgeBits;
+
+    //! State of keyboard buttons, one bit per key
+    unsigned int keyBits[GLFW_KEY_LAST / 32 + 1];
+
+    //! Keyboard buttons pressed since the last frame
+    unsigned int keyEdgeBits[GLFW_KEY_LAST / 32 + 1];
+};
+
 struct EngineBuffer
 {
     //! Window height
@@ -33,11 +65,100 @@ struct EngineBuffer
     //! Mouse Y position
     int mouseY = 0;
 
-    //! State of mouse buttons
-    int btnState[GLFW_MOUSE_BUTTON_LAST] = {0};
+    //! Time accumulated towards the next fixed step, as a fraction of the step
+    float stepAlpha = 0;
 
-    //! State of keyboard button
-    int keyState[GLFW_KEY_LAST] = {0};
+    //! Fraction of the window resolution draw programs render at, set by FRAME_BUDGET_MS param
+    float resolutionScale = 1;
+
+    //! Input state, layout is selected by PACKED_INPUT param
+    union
+    {
+        InputState input = {};
+        PackedInputState packedInput;
+    };
+};
+
+enum class CommandType
+{
+    Dispatch,
+    DrawArrays,
+    DrawElements
+};
+
+struct Command
+{
+    //! Program the command was baked from
+    Program *program = nullptr;
+
+    //! Index of the program
+    int index = 0;
+
+    //! Type of the work executed by the command
+    CommandType type = CommandType::Dispatch;
+
+    //! OpenGL program ID
+    GLuint programId = 0;
+
+    //! OpenGL vertex array ID
+    GLuint varray = 0;
+
+    //! OpenGL framebuffer ID the draw renders into
+    GLuint framebuffer = 0;
+
+    //! Size of the custom framebuffer's attachments, zero if the draw renders at window size
+    GLsizei viewportWidth = 0, viewportHeight = 0;
+
+    //! Range of the command's buffer bindings in Engine::commandBuffers
+    size_t buffersBegin = 0, buffersEnd = 0;
+
+    //! Range of the command's texture bindings in Engine::commandTextures
+    size_t texturesBegin = 0, texturesEnd = 0;
+
+    //! Offset of the dispatch command or draw commands in their buffer
+    GLintptr indirectOffset = 0;
+
+    //! Number of work groups of direct dispatch, indirect dispatch is used if zero
+    GLuint dispatchSize[3] = {0, 0, 0};
+
+    //! Number of dispatches of the command in one frame
+    GLuint iterations = 1;
+
+    //! Location of the iteration index uniform, -1 if not used
+    GLint iterationLocation = -1;
+
+    //! Memory barrier issued between iterations of the command
+    GLbitfield iterationBarriers = 0;
+
+    //! Offset of the draw count in the draw command buffer
+    GLintptr drawCountOffset = 0;
+
+    //! Memory barrier issued before the command
+    GLbitfield barriers = 0;
+
+    //! Whether the program is retired after the command
+    bool isRanOnce = false;
+
+    //! Whether the command might not run in some frames
+    bool isScheduled = false;
+
+    //! Number of frames between runs, set by EVERY param
+    GLuint every = 1;
+
+    //! Minimal time between runs in seconds, set by RATE param
+    double period = 0;
+
+    //! Whether the command runs once per elapsed fixed time step, set by FIXED_STEP param
+    bool isFixedStep = false;
+
+    //! Engine time of the last run, used by RATE param
+    double lastRunTime = -1;
+
+    //! Buffer with the value enabling the command, 0 if the command is not predicated
+    GLuint predicateBuffer = 0;
+
+    //! Offset of the value enabling the command in 4 byte words
+    GLuint predicateOffset = 0;
 };
 
 class Engine
@@ -69,12 +190,36 @@ public:
     //! Whether the engine standard output should be verbose
     bool verbose = false;
 
+    //! Whether the engine should run without window in offscreen context
+    bool headless = false;
+
+    //! Whether programs should be recompiled when shader file changes
+    bool watch = false;
+
+    //! Whether frames are rendered as fast as possible for batch runs, ignoring TARGET_FPS, VSYNC and ON_DEMAND params
+    bool batch = false;
+
+    //! Path of the Trace Event Format output, tracing is disabled if empty
+    std::string traceFilename;
+
+    //! Tracer of CPU and GPU spans
+    Tracer tracer;
+
+    //! Directory of the program binary cache, caching is disabled if empty
+    std::string cacheDirectory;
+
+    //! Synthetic time step in seconds, real time is used if zero
+    double fixedDeltaTime = 0;
+
+    //! Wait until all submitted frames are finished by GPU
+    void finish();
+
     //! Print message to standard output if verbose is turned on
     void print(const char *format, ...);
 
     /*!
      * @brief Create texture
-     * @param name Texture name, format: name_$(sizeX)x$(sizeY) 
+     * @param name Texture name, format: name_$(sizeX)x$(sizeY), or name_screen, name_half and name_quarter relative to window size
      * @return OpenGL texture ID
      */
     GLuint createTexture(std::string name);
@@ -93,15 +238,166 @@ public:
     //! Map of created buffers and it's ids
     std::map<std::string, GLuint> buffers;
 
+    //! Map of created buffers and their sizes
+    std::map<std::string, int> bufferSizes;
+
     //! List of global params
     std::map<std::string, std::string> params;
+
+    //! Maximum number of draw commands of a program, set by DRAW_COMMANDS param
+    GLsizei getDrawCommandCapacity();
 private:
     //! OpenGL context
     GLFWwindow *context = nullptr;
 
+#ifdef HEADLESS
+    //! EGL display used by headless context
+    EGLDisplay display = EGL_NO_DISPLAY;
+
+    //! EGL context used by headless context
+    EGLContext headlessContext = EGL_NO_CONTEXT;
+
+    //! EGL pbuffer surface, used only if surfaceless context is not supported
+    EGLSurface headlessSurface = EGL_NO_SURFACE;
+#endif
+
+    //! Framebuffer that replaces window framebuffer (0 if window is used)
+    GLuint defaultFramebuffer = 0;
+
+    //! Color and depth/stencil renderbuffers of the offscreen framebuffer
+    GLuint renderbuffers[2] = {0};
+
+    //! Time of the engine initialization, used as time source in headless mode
+    double startTime = 0;
+
+    //! Create window and OpenGL context using GLFW
+    void createWindowContext();
+
+    //! Create windowless OpenGL context using EGL and offscreen framebuffer, fails if built without EGL
+    void createHeadlessContext();
+
+    //! Whether the OpenGL context is initialized
+    bool isInitialized();
+
+    //! Get time elapsed since the engine initialization in seconds
+    double getTime();
+
+    //! Shadowed OpenGL state used to skip redundant calls
+    StateCache state;
+
+    //! GPU profiler of programs, enabled by BENCHMARK param
+    Profiler profiler;
+
+    //! GPU time of scaled draws the resolution scale is adjusted to in microseconds, set by FRAME_BUDGET_MS param
+    double frameBudget = 0;
+
+    //! Framebuffer draw programs render into at scaled resolution, blitted to the default framebuffer
+    GLuint scaledFramebuffer = 0;
+
+    //! Color and depth/stencil renderbuffers of the scaled framebuffer, allocated at full resolution
+    GLuint scaledRenderbuffers[2] = {0};
+
+    //! Create or resize scaled framebuffer to the window size
+    void createScaledFramebuffer();
+
+    //! Choose resolution scale from the latest measured GPU frame time
+    void updateResolutionScale();
+
+    //! Whether window size changed since screen relative textures were allocated
+    bool isScreenResized = false;
+
+    /*!
+     * @brief Get size of the texture from its name
+     * @param name Texture name
+     * @return Width, height and whether the size is relative to window size
+     */
+    std::tuple<int, int, bool> getTextureSize(const std::string &name);
+
+    //! Replace screen relative textures which do not match window size, in programs and commands too
+    void resizeScreenTextures();
+
+    //! Minimal frame time in seconds, set by TARGET_FPS param
+    double targetFrameTime = 0;
+
+    //! Time the last paced frame was due
+    double frameDeadline = 0;
+
+    //! Whether frames are rendered only on input or request from shaders, set by ON_DEMAND param
+    bool isOnDemand = false;
+
+    //! Whether next frame should be rendered in ON_DEMAND mode
+    bool isFrameRequested = true;
+
+    //! Wait until the next frame is due, sleep first and spin for the last part, sleep is not precise
+    void paceFrame();
+
+    //! Wait for input, file change or request from shaders in ON_DEMAND mode
+    void waitForRequest();
+
+    //! Buffer with frame request flags copied from the work group buffer, one per frame in flight
+    GLuint requestBuffer = 0;
+
+    //! Persistent mapping of the request buffer
+    GLuint *requestMapping = nullptr;
+
+    //! Whether request flag of the frame in the slot was not read yet
+    std::vector<bool> requestPending;
+
+    //! Whether the last frame whose flag was read requested another one
+    bool wasFrameRequested = false;
+
+    /*!
+     * @brief Read request flags of finished frames without waiting
+     * @return Whether some frames in flight were not read yet
+     */
+    bool readRequests();
+
+    //! Length of the fixed time step in seconds, set by FIXED_STEP param
+    double fixedStep = 0;
+
+    //! Time not consumed by fixed steps yet
+    double stepAccumulator = 0;
+
+    //! Number of fixed steps of the current frame
+    GLuint fixedSteps = 0;
+
+    //! Maximum number of fixed steps in one frame, the rest of the time is dropped
+    static const GLuint maxFixedSteps = 8;
+
+    /*!
+     * @brief Copy dispatch size or draw count of the predicated command into its pbo range, zero if it is disabled
+     * @param command Predicated command
+     */
+    void runPredicate(const Command &command);
+
+    /*!
+     * @brief Bind storage buffers of the command
+     * @param command Command whose buffers are bound
+     */
+    void bindCommandBuffers(const Command &command);
+
+    /*!
+     * @brief Decide how many times the command runs in the current frame
+     * @param command Command to schedule, its last run time is updated
+     * @return Number of runs, zero if the command is skipped
+     */
+    GLuint scheduleCommand(Command &command);
+
+    //! Number of frames between profiler reports, reported only on exit if zero
+    long benchmarkInterval = 0;
+
+    //! Number of frames since the engine initialization
+    long frameCount = 0;
+
     //! Engine buffer instance
     EngineBuffer engineBuffer;
 
+    //! Size of the engine buffer part visible to shaders
+    size_t engineBufferSize = sizeof(EngineBuffer);
+
+    //! Whether input state uses bit-packed layout
+    bool isInputPacked = false;
+
     //! Time of the last frame
     double lastFrameTime = 0;
 
@@ -120,14 +416,105 @@ private:
     //! List of compiled program instances
     std::vector<Program*> programs;
 
+    //! Path of the shader file
+    std::string filename;
+
+    //! Name of the watched shader file within its directory
+    std::string watchedName;
+
+    //! Inotify instance watching the shader file, -1 if not watched
+    int inotify = -1;
+
+    //! Start watching the shader file for changes
+    void watchFile();
+
+    //! Whether the shader file changed since the last check
+    bool isFileChanged();
+
+    //! Recompile programs changed in the shader file, keeping old programs if compilation fails
+    void reload();
+
+    //! Commands executed every frame, baked from programs that are not ignored
+    std::vector<Command> commands;
+
+    //! Buffers and their binding points used by commands
+    std::vector<std::tuple<GLuint, GLuint>> commandBuffers;
+
+    //! Textures, their types, units and access used by commands
+    std::vector<std::tuple<GLuint, GLenum, GLuint, GLenum>> commandTextures;
+
+    //! Bake list of commands from programs that are not ignored
+    void bakeCommands();
+
+    //! Compute minimal memory barriers between commands from their resource usage
+    void computeBarriers();
+
     //! Engine Buffer Object
     GLuint ebo;
 
-    //! Work Group Buffer Object
-    GLuint wgbo;
+    //! Number of frames in flight, each has its engine buffer copy in the persistently mapped ring buffer
+    int engineBufferSlots = 3;
+
+    //! Size of one engine buffer copy, aligned to SSBO offset alignment
+    GLsizeiptr engineBufferSlotSize = 0;
+
+    //! Index of the engine buffer copy used by the current frame
+    int engineBufferSlot = 0;
+
+    //! Persistent mapping of the engine buffer object
+    char *engineBufferMapping = nullptr;
+
+    //! Fences guarding engine buffer copies that may still be read by GPU
+    std::vector<GLsync> engineBufferFences;
 
-    //! Draw Command Buffer Object
-    GLuint dcbo;
+    //! Time when frames in flight were submitted, negative once their completion was observed
+    std::vector<double> engineBufferSubmitTimes;
+
+    //! Byte ranges of the engine buffer changed since each slot was last written
+    std::vector<std::vector<std::pair<size_t, size_t>>> engineBufferDirtyRanges;
+
+    /*!
+     * @brief Mark part of the engine buffer as changed
+     * @param field Pointer to the changed field of the engine buffer
+     * @param size Size of the changed field in bytes
+     */
+    void markDirty(const void *field, size_t size);
+
+    /*!
+     * @brief Wait until GPU finishes the frame that used the current slot, collect latency of finished frames
+     * @param isProfiled Whether to add wait time and frame latencies to profiler statistics
+     */
+    void waitForSlot(bool isProfiled);
+
+    //! Copy changed parts of engine buffer into the current slot and bind it
+    void uploadEngineBuffer();
+
+    //! Work Group Buffer Object, frame request followed by dispatch command of each program
+    GLuint wgbo = 0;
+
+    //! Draw Command Buffer Object, draw count followed by the draw commands of each program
+    GLuint dcbo = 0;
+
+    //! Predicate Buffer Object, indirect arguments of each predicated program, zero if disabled
+    GLuint pbo = 0;
+
+    //! Built-in program writing indirect arguments of predicated programs
+    GLuint predicateProgram = 0;
+
+    //! Number of programs with a range in wgbo, dcbo and pbo
+    size_t commandRanges = 0;
+
+    //! Maximum number of draw commands of a program, set by DRAW_COMMANDS param
+    GLsizei drawCommandCapacity = 100;
+
+    //! Size of one program's range in dcbo
+    size_t getDrawCommandRangeSize();
+
+    /*!
+     * @brief Grow wgbo, dcbo and pbo to hold ranges of programs, contents of existing wgbo and dcbo ranges are kept
+     * @param ranges Number of ranges, the highest program index plus one
+     */
+    void reserveCommandRanges(size_t ranges);
 };
 
 #endif
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <chrono>
+#include <string>
 #include <iostream>
 #include <stdexcept>
 
@@ -5,20 +7,72 @@
 
 int main(int argc, char **argv)
 {
-    if(argc != 2)
+    auto engine = Engine();
+    std::string filename;
+    bool invalid = false;
+    long frames = 0;
+
+    for(int i = 1; i < argc; i++)
+    {
+        auto argument = std::string(argv[i]);
+
+        try {
+            if(argument == "--headless")
+                engine.headless = true;
+            else if(argument == "--watch")
+                engine.watch = true;
+            else if(argument == "--no-cache")
+                engine.cacheDirectory.clear();
+            else if(argument == "--trace" && i + 1 < argc)
+                engine.traceFilename = argv[++i];
+            else if(argument == "--frames" && i + 1 < argc)
+                frames = std::stol(argv[++i]);
+            else if(argument == "--fixed-dt" && i + 1 < argc)
+                engine.fixedDeltaTime = std::stod(argv[++i]);
+            else if(!argument.starts_with("--") && filename.empty())
+                filename = argument;
+            else
+                invalid = true;
+        } catch(const std::logic_error&) {
+            invalid = true;
+        }
+    }
+
+    if(invalid || filename.empty() || frames < 0 || engine.fixedDeltaTime < 0)
     {
         std::cout << "Invalid parameters" << std::endl;
+        std::cout << "Usage: " << argv[0] << " [--headless] [--watch] [--no-cache] [--trace FILE] [--frames N] [--fixed-dt S] <shader-file-path>" << std::endl;
         return 1;
     }
 
-    auto engine = Engine();
+    // Batch runs are not limited by frame pacing or waiting for input
+    engine.batch = frames > 0;
 
     try {
         // Initialize engine with shader file
-        engine.init(std::string(argv[1]));
-        // Update engine state while window is open
-        while(!engine.shouldClose())
-            engine.update();
+        engine.init(filename);
+
+        if(frames == 0)
+        {
+            // Update engine state while window is open
+            while(!engine.shouldClose())
+                engine.update();
+        }
+        else
+        {
+            // Run fixed number of frames as fast as possible and report throughput
+            auto startTime = std::chrono::steady_clock::now();
+
+            long frame = 0;
+            for(; frame < frames && !engine.shouldClose(); frame++)
+                engine.update();
+            engine.finish();
+
+            auto duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            if(frame > 0)
+                std::cout << "Finished " << frame << " frames in " << duration << " s (" 
+                          << frame / duration << " FPS, " << duration * 1000 / frame << " ms per frame)" << std::endl;
+        }
     } catch(const std::exception& e) {
         std::cout << e.what() << std::endl;
     }
@@ -26,4 +80,4 @@ int main(int argc, char **argv)
     // Cleanup resources allocated by the engine
     engine.destroy();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,248 @@
+#include "parser.hpp"
+
+#include <cctype>
+#include <algorithm>
+#include <charconv>
+
+namespace
+{
+    bool isIdentifier(char character)
+    {
+        return std::isalnum(static_cast<unsigned char>(character)) || character == '_';
+    }
+
+    std::string_view trim(std::string_view text)
+    {
+        while(!text.empty() && std::isspace(static_cast<unsigned char>(text.front())))
+            text.remove_prefix(1);
+        while(!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+            text.remove_suffix(1);
+        return text;
+    }
+
+    std::string_view nextToken(std::string_view &text)
+    {
+        text = trim(text);
+
+        size_t length = 0;
+        while(length < text.size() && !std::isspace(static_cast<unsigned char>(text[length])) && text[length] != ';')
+            length++;
+
+        auto token = text.substr(0, length);
+        text.remove_prefix(length);
+        return token;
+    }
+}
+
+Manifest Parser::parse(std::string_view source)
+{
+    Manifest manifest;
+    std::map<int, std::map<std::string, std::string>> programParams;
+    std::vector<std::tuple<int, size_t>> conditionals;
+
+    // Start of the current statement, everything between it and a declaration are qualifiers
+    size_t statement = 0;
+    bool isLineStart = true;
+
+    size_t i = 0;
+    while(i < source.size())
+    {
+        auto character = source[i];
+
+        if(character == '\n')
+        {
+            isLineStart = true;
+            i++;
+        }
+        else if(std::isspace(static_cast<unsigned char>(character)))
+        {
+            i++;
+        }
+        else if(character == '#' && isLineStart)
+        {
+            auto end = std::min(source.find('\n', i), source.size());
+            parseDirective(source.substr(i + 1, end - i - 1), i, end, manifest, programParams, conditionals);
+            statement = i = end;
+        }
+        else if(character == '/' && i + 1 < source.size() && source[i + 1] == '/')
+        {
+            i = std::min(source.find('\n', i), source.size());
+        }
+        else if(character == '/' && i + 1 < source.size() && source[i + 1] == '*')
+        {
+            auto end = source.find("*/", i + 2);
+            i = end == std::string_view::npos ? source.size() : end + 2;
+        }
+        else if(isIdentifier(character))
+        {
+            isLineStart = false;
+
+            auto begin = i;
+            while(i < source.size() && isIdentifier(source[i]))
+                i++;
+
+            auto word = source.substr(begin, i - begin);
+            if(word != "buffer" && word != "image2D")
+                continue;
+
+            // Declaration is followed by the resource name
+            auto nameBegin = i;
+            while(nameBegin < source.size() && std::isspace(static_cast<unsigned char>(source[nameBegin])))
+                nameBegin++;
+            auto nameEnd = nameBegin;
+            while(nameEnd < source.size() && isIdentifier(source[nameEnd]))
+                nameEnd++;
+
+            if(nameEnd == nameBegin)
+                continue;
+
+            auto qualifiers = source.substr(statement, begin - statement);
+            GLenum current = GL_READ_WRITE;
+            if(qualifiers.find("readonly") != std::string_view::npos)
+                current = GL_READ_ONLY;
+            else if(qualifiers.find("writeonly") != std::string_view::npos)
+                current = GL_WRITE_ONLY;
+
+            // Resource declared differently in multiple places is treated as read-write
+            auto key = std::string(word) + " " + std::string(source.substr(nameBegin, nameEnd - nameBegin));
+            auto [it, isInserted] = manifest.access.try_emplace(key, current);
+            if(!isInserted && it->second != current)
+                it->second = GL_READ_WRITE;
+
+            i = nameEnd;
+        }
+        else
+        {
+            isLineStart = false;
+
+            if(character == ';' || character == '{' || character == '}')
+                statement = i + 1;
+            i++;
+        }
+    }
+
+    for(auto &program : manifest.programs)
+        program.params = programParams[program.index];
+
+    return manifest;
+}
+
+std::string Parser::scope(std::string_view source, const Manifest &manifest, int index)
+{
+    std::string scoped(source);
+    for(auto const& program : manifest.programs)
+    {
+        if(program.index == index)
+            continue;
+
+        // Newlines are kept so that compile errors point to the right lines
+        for(auto const& [begin, end] : program.blocks)
+            std::replace_if(scoped.begin() + begin, scoped.begin() + end, [](char character) { return character != '\n'; }, ' ');
+    }
+
+    return scoped;
+}
+
+void Parser::parseDirective(std::string_view directive, size_t begin, size_t end, Manifest &manifest, std::map<int, std::map<std::string, std::string>> &programParams, std::vector<std::tuple<int, size_t>> &conditionals)
+{
+    auto keyword = nextToken(directive);
+
+    if(keyword == "if" || keyword == "ifndef")
+    {
+        conditionals.push_back({-1, end});
+    }
+    else if(keyword == "elif" || keyword == "else" || keyword == "endif")
+    {
+        if(conditionals.empty())
+            return;
+
+        // Only the first branch of #ifdef PROGRAM_$(index) belongs to the program
+        auto &[program, body] = conditionals.back();
+        if(program >= 0)
+        {
+            auto it = std::find_if(manifest.programs.begin(), manifest.programs.end(), [program](auto const& current) {
+                return current.index == program;
+            });
+            it->blocks.push_back({body, begin});
+            program = -1;
+        }
+
+        if(keyword == "endif")
+            conditionals.pop_back();
+    }
+    else if(keyword == "ifdef")
+    {
+        int index;
+        std::string_view suffix;
+        if(!parseProgramIdentifier(nextToken(directive), index, suffix))
+        {
+            conditionals.push_back({-1, end});
+            return;
+        }
+
+        conditionals.push_back({index, end});
+
+        auto it = std::find_if(manifest.programs.begin(), manifest.programs.end(), [index](auto const& program) {
+            return program.index == index;
+        });
+
+        if(it == manifest.programs.end())
+        {
+            manifest.programs.push_back(ProgramManifest());
+            it = std::prev(manifest.programs.end());
+            it->index = index;
+        }
+
+        if(!suffix.empty())
+            it->stages.insert(std::string(suffix));
+    }
+    else if(keyword == "pragma")
+    {
+        auto target = nextToken(directive);
+
+        int index;
+        std::string_view suffix;
+        if(target == "PARAM")
+            parseParam(directive, manifest.params);
+        else if(parseProgramIdentifier(target, index, suffix) && suffix == "PARAM")
+            parseParam(directive, programParams[index]);
+    }
+}
+
+void Parser::parseParam(std::string_view param, std::map<std::string, std::string> &params)
+{
+    // Param has to be terminated by semicolon
+    auto end = param.find(';');
+    if(end == std::string_view::npos)
+        return;
+
+    param = param.substr(0, end);
+    auto name = nextToken(param);
+    if(name.empty())
+        return;
+
+    // Quotes are not part of the value
+    auto value = trim(param);
+    if(value.size() >= 2 && value.front() == '"' && value.back() == '"')
+        value = value.substr(1, value.size() - 2);
+
+    params[std::string(name)] = std::string(value);
+}
+
+bool Parser::parseProgramIdentifier(std::string_view identifier, int &index, std::string_view &suffix)
+{
+    if(!identifier.starts_with("PROGRAM_"))
+        return false;
+
+    identifier.remove_prefix(8);
+    auto [end, error] = std::from_chars(identifier.data(), identifier.data() + identifier.size(), index);
+    if(error != std::errc() || end == identifier.data())
+        return false;
+
+    identifier.remove_prefix(end - identifier.data());
+    if(!identifier.empty() && identifier.front() != '_')
+        return false;
+
+    suffix = identifier.empty() ? identifier : identifier.substr(1);
+    return true;
+}
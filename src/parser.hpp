@@ -0,0 +1,88 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include <GL/glew.h>
+
+struct ProgramManifest
+{
+    //! Index of the program
+    int index = 0;
+
+    //! Shader stages present in the source, for example COMPUTE_SHADER
+    std::set<std::string> stages;
+
+    //! List of program's params
+    std::map<std::string, std::string> params;
+
+    //! Byte ranges of bodies of #ifdef PROGRAM_$(index) blocks in the source
+    std::vector<std::tuple<size_t, size_t>> blocks;
+};
+
+struct Manifest
+{
+    //! List of global params
+    std::map<std::string, std::string> params;
+
+    //! Programs in order of their first appearance
+    std::vector<ProgramManifest> programs;
+
+    //! Access of declared resources by their declaration, for example "buffer Name"
+    std::map<std::string, GLenum> access;
+};
+
+class Parser
+{
+public:
+    /*!
+     * @brief Parse shader file in a single pass
+     * @param source Shader file source
+     * @return Manifest of the shader file
+     */
+    static Manifest parse(std::string_view source);
+
+    /*!
+     * @brief Strip bodies of blocks of other programs from the source, line numbers are kept
+     * @param source Shader file source
+     * @param manifest Manifest of the shader file
+     * @param index Index of the program
+     * @return Source seen by the program
+     */
+    static std::string scope(std::string_view source, const Manifest &manifest, int index);
+
+private:
+    /*!
+     * @brief Parse preprocessor directive
+     * @param directive Directive line without leading '#'
+     * @param begin Offset of the directive line in the source
+     * @param end Offset of the end of the directive line in the source
+     * @param manifest Manifest being built
+     * @param programParams Params of programs by their index
+     * @param conditionals Open conditional blocks as program index (-1 if none) and offset of the body
+     */
+    static void parseDirective(std::string_view directive, size_t begin, size_t end, Manifest &manifest, std::map<int, std::map<std::string, std::string>> &programParams, std::vector<std::tuple<int, size_t>> &conditionals);
+
+    /*!
+     * @brief Parse param pragma in format NAME [value];
+     * @param param Pragma text after PARAM keyword
+     * @param params Map of params the param is stored into
+     */
+    static void parseParam(std::string_view param, std::map<std::string, std::string> &params);
+
+    /*!
+     * @brief Parse identifier in format PROGRAM_$(index)[_$(suffix)]
+     * @param identifier Parsed identifier
+     * @param index Index of the program
+     * @param suffix Part of the identifier after program index
+     * @return Whether the identifier refers to a program
+     */
+    static bool parseProgramIdentifier(std::string_view identifier, int &index, std::string_view &suffix);
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "profiler.hpp"
+
+#include <cstdio>
+#include <numeric>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+//! Pipeline statistics query targets and their report headers
+static const std::tuple<GLenum, const char*> counters[] = {
+    {GL_VERTEX_SHADER_INVOCATIONS_ARB, "vertex"},
+    {GL_FRAGMENT_SHADER_INVOCATIONS_ARB, "fragment"},
+    {GL_COMPUTE_SHADER_INVOCATIONS_ARB, "compute"},
+    {GL_PRIMITIVES_GENERATED, "primitives"},
+    {GL_CLIPPING_INPUT_PRIMITIVES_ARB, "clip in"},
+    {GL_CLIPPING_OUTPUT_PRIMITIVES_ARB, "clip out"},
+};
+
+void Profiler::init(int latency, int window, bool isPipelineStatistics)
+{
+    this->queries.assign(latency, {});
+    this->statisticsQueries.assign(latency, {});
+    this->ranges.assign(latency, {});
+    this->window = window;
+    this->isPipelineStatistics = isPipelineStatistics;
+    this->slot = 0;
+    this->queryCount = 0;
+    this->statisticsCount = 0;
+    this->samples.clear();
+    this->statistics.clear();
+    this->latestGpuPrograms.clear();
+}
+
+void Profiler::destroy()
+{
+    for(auto &queries : this->queries)
+        glDeleteQueries(queries.size(), queries.data());
+    for(auto &queries : this->statisticsQueries)
+        glDeleteQueries(queries.size(), queries.data());
+
+    this->queries.clear();
+    this->statisticsQueries.clear();
+    this->ranges.clear();
+    this->samples.clear();
+    this->statistics.clear();
+    this->isPipelineStatistics = false;
+}
+
+bool Profiler::isEnabled()
+{
+    return !this->queries.empty();
+}
+
+void Profiler::beginFrame()
+{
+    this->readSlot(this->slot, false);
+    this->queryCount = 0;
+    this->statisticsCount = 0;
+}
+
+void Profiler::flush()
+{
+    // Slots are read from the oldest one, so samples stay in order
+    for(size_t i = 1; i <= this->queries.size(); i++)
+        this->readSlot((this->slot + i) % this->queries.size(), true);
+}
+
+void Profiler::beginProgram(int index)
+{
+    auto query = this->nextQuery();
+    glQueryCounter(this->queries[this->slot][query], GL_TIMESTAMP);
+
+    // Each counter has its own target, so all of them can be active at once
+    auto statisticsQuery = this->statisticsCount;
+    if(this->isPipelineStatistics)
+    {
+        auto &queries = this->statisticsQueries[this->slot];
+        if(this->statisticsCount == queries.size())
+        {
+            queries.resize(queries.size() + counterCount);
+            glGenQueries(counterCount, queries.data() + this->statisticsCount);
+        }
+
+        for(size_t i = 0; i < counterCount; i++)
+            glBeginQuery(std::get<0>(counters[i]), queries[this->statisticsCount + i]);
+        this->statisticsCount += counterCount;
+    }
+
+    this->ranges[this->slot].push_back(std::make_tuple(index, query, query, statisticsQuery));
+}
+
+void Profiler::endProgram()
+{
+    if(this->isPipelineStatistics)
+    {
+        for(auto const& [target, name] : counters)
+            glEndQuery(target);
+    }
+
+    auto query = this->nextQuery();
+    glQueryCounter(this->queries[this->slot][query], GL_TIMESTAMP);
+    std::get<2>(this->ranges[this->slot].back()) = query;
+}
+
+void Profiler::endFrame(double cpuTime)
+{
+    this->addSample(cpuFrame, cpuTime);
+    this->slot = (this->slot + 1) % this->queries.size();
+}
+
+std::map<int, double> Profiler::takeGpuProgramTimes()
+{
+    std::map<int, double> times;
+    std::swap(times, this->latestGpuPrograms);
+    return times;
+}
+
+std::string Profiler::report()
+{
+    std::string report = "Program          min        avg        p50        p99 (microseconds)\n";
+
+    for(auto const& [index, sample] : this->samples)
+    {
+        auto values = std::get<0>(sample);
+        if(values.empty())
+            continue;
+
+        std::sort(values.begin(), values.end());
+        auto average = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+        auto p50 = values[values.size() * 50 / 100];
+        auto p99 = values[values.size() * 99 / 100];
+
+        char name[32];
+        if(index == frameWait)
+            snprintf(name, sizeof(name), "frame wait");
+        else if(index == frameLatency)
+            snprintf(name, sizeof(name), "latency");
+        else if(index == cpuFrame)
+            snprintf(name, sizeof(name), "frame (CPU)");
+        else if(index == gpuFrame)
+            snprintf(name, sizeof(name), "frame (GPU)");
+        else
+            snprintf(name, sizeof(name), "PROGRAM_%d", index);
+
+        char line[128];
+        snprintf(line, sizeof(line), "%-12s %10.1f %10.1f %10.1f %10.1f\n", name, values.front(), average, p50, p99);
+        report += line;
+    }
+
+    if(this->statistics.empty())
+        return report;
+
+    report += "Program    ";
+    for(auto const& [target, name] : counters)
+    {
+        char header[16];
+        snprintf(header, sizeof(header), " %11s", name);
+        report += header;
+    }
+    report += " (average per frame)\n";
+
+    for(auto const& [index, statistic] : this->statistics)
+    {
+        auto const& [sums, count] = statistic;
+
+        char line[128];
+        snprintf(line, sizeof(line), "PROGRAM_%-3d", index);
+        report += line;
+
+        for(auto sum : sums)
+        {
+            snprintf(line, sizeof(line), " %11llu", static_cast<unsigned long long>(sum / count));
+            report += line;
+        }
+        report += "\n";
+    }
+
+    return report;
+}
+
+void Profiler::readSlot(size_t slot, bool isBlocking)
+{
+    auto &queries = this->queries[slot];
+    auto &ranges = this->ranges[slot];
+
+    if(ranges.empty())
+        return;
+
+    // Results are read only if they are ready, profiler never stalls the pipeline
+    GLint isAvailable = GL_FALSE;
+    glGetQueryObjectiv(queries[std::get<2>(ranges.back())], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+
+    if(isAvailable == GL_TRUE || isBlocking)
+    {
+        this->latestGpuPrograms.clear();
+
+        GLuint64 frameBegin = 0, frameEnd = 0;
+        for(auto const& [index, begin, end, statisticsBegin] : ranges)
+        {
+            GLuint64 beginTime, endTime;
+            glGetQueryObjectui64v(queries[begin], GL_QUERY_RESULT, &beginTime);
+            glGetQueryObjectui64v(queries[end], GL_QUERY_RESULT, &endTime);
+            this->addSample(index, (endTime - beginTime) / 1000.0);
+            this->latestGpuPrograms[index] += (endTime - beginTime) / 1000.0;
+
+            // Statistics queries ended together with the end timestamp, so they are available too
+            if(this->isPipelineStatistics)
+            {
+                auto &[sums, count] = this->statistics[index];
+                for(size_t i = 0; i < counterCount; i++)
+                {
+                    GLuint64 value;
+                    glGetQueryObjectui64v(this->statisticsQueries[slot][statisticsBegin + i], GL_QUERY_RESULT, &value);
+                    sums[i] += value;
+                }
+                count++;
+            }
+
+            if(this->tracer != nullptr)
+                this->tracer->recordGpu("PROGRAM", beginTime, endTime, index);
+
+            frameBegin = frameBegin == 0 ? beginTime : std::min(frameBegin, beginTime);
+            frameEnd = std::max(frameEnd, endTime);
+        }
+
+        this->addSample(gpuFrame, (frameEnd - frameBegin) / 1000.0);
+
+        if(this->tracer != nullptr)
+            this->tracer->recordGpu("frame", frameBegin, frameEnd);
+    }
+
+    ranges.clear();
+}
+
+size_t Profiler::nextQuery()
+{
+    auto &queries = this->queries[this->slot];
+
+    // Query pool grows with number of programs
+    if(this->queryCount == queries.size())
+    {
+        GLuint query;
+        glGenQueries(1, &query);
+        queries.push_back(query);
+    }
+
+    return this->queryCount++;
+}
+
+void Profiler::addSample(int index, double value)
+{
+    auto &[values, next] = this->samples[index];
+
+    if(values.size() < this->window)
+    {
+        values.push_back(value);
+        return;
+    }
+
+    values[next] = value;
+    next = (next + 1) % this->window;
+}
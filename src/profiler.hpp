@@ -0,0 +1,130 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <map>
+#include <array>
+#include <tuple>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "tracer.hpp"
+
+class Profiler
+{
+public:
+    /*!
+     * @brief Create query objects and start profiling
+     * @param latency Number of frames before query results are read back
+     * @param window Number of the most recent samples used for statistics
+     * @param isPipelineStatistics Whether to count shader invocations and primitives of programs
+     */
+    void init(int latency = 4, int window = 1024, bool isPipelineStatistics = false);
+
+    //! Delete query objects
+    void destroy();
+
+    //! Whether the profiler is initialized
+    bool isEnabled();
+
+    //! Read back results of the frame that used the current query slot
+    void beginFrame();
+
+    //! Wait for all pending queries and read back their results
+    void flush();
+
+    /*!
+     * @brief Record GPU timestamp before the program
+     * @param index Index of the program
+     */
+    void beginProgram(int index);
+
+    //! Record GPU timestamp after the program
+    void endProgram();
+
+    /*!
+     * @brief Finish the frame
+     * @param cpuTime CPU time of the frame in microseconds
+     */
+    void endFrame(double cpuTime);
+
+    //! Get GPU times of programs by index in the latest frame read back since the last call in microseconds, empty if there is none
+    std::map<int, double> takeGpuProgramTimes();
+
+    //! Get table with min/avg/p50/p99 statistics, and average pipeline statistics if counted
+    std::string report();
+
+    //! Tracer receiving GPU spans of programs, not used if null
+    Tracer *tracer = nullptr;
+
+    /*!
+     * @brief Add sample to statistics
+     * @param index Index of the program or frame statistics
+     * @param value Sample value in microseconds
+     */
+    void addSample(int index, double value);
+
+    //! Index of the CPU time spent waiting for a free frame slot
+    static const int frameWait = -4;
+
+    //! Index of the time between frame submission and observed GPU completion
+    static const int frameLatency = -3;
+
+    //! Index of the CPU frame time statistics
+    static const int cpuFrame = -2;
+
+    //! Index of the GPU frame time statistics
+    static const int gpuFrame = -1;
+private:
+    //! Number of pipeline statistics counters of each program
+    static const size_t counterCount = 6;
+
+    //! Query objects of each frame slot
+    std::vector<std::vector<GLuint>> queries;
+
+    //! Pipeline statistics query objects of each frame slot, counterCount per program
+    std::vector<std::vector<GLuint>> statisticsQueries;
+
+    //! Number of used pipeline statistics queries in the current slot
+    size_t statisticsCount = 0;
+
+    //! Whether pipeline statistics are counted
+    bool isPipelineStatistics = false;
+
+    //! Sums of pipeline statistics counters and number of summed frames by program index
+    std::map<int, std::tuple<std::array<GLuint64, counterCount>, size_t>> statistics;
+
+    //! Program indexes, their begin/end query positions and statistics query positions of each frame slot
+    std::vector<std::vector<std::tuple<int, size_t, size_t, size_t>>> ranges;
+
+    //! Number of used queries in the current slot
+    size_t queryCount = 0;
+
+    //! Index of the current query slot
+    size_t slot = 0;
+
+    //! Number of the most recent samples used for statistics
+    size_t window = 0;
+
+    //! GPU times of programs in the latest frame not taken yet
+    std::map<int, double> latestGpuPrograms;
+
+    //! Recent samples and the position of the next sample by program index
+    std::map<int, std::tuple<std::vector<double>, size_t>> samples;
+
+    /*!
+     * @brief Read back results of the query slot
+     * @param slot Index of the query slot
+     * @param isBlocking Whether to wait for results that are not available yet
+     */
+    void readSlot(size_t slot, bool isBlocking);
+
+    /*!
+     * @brief Get next query of the current slot, create it if needed
+     * @return Position of the query in the current slot
+     */
+    size_t nextQuery();
+};
+
+#endif
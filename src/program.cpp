@@ -2,13 +2,20 @@
 
 #include <map>
 #include <regex>
+#include <set>
 #include <string>
+#include <fstream>
 #include <sstream>
+#include <iterator>
 #include <stdexcept>
+#include <random>
+#include <algorithm>
+#include <filesystem>
 
 #include <GL/glew.h>
 
 #include "engine.hpp"
+#include "parser.hpp"
 #include "shaders.hpp"
 #include "utils.hpp"
 
@@ -32,79 +39,165 @@ Program::~Program()
     glDeleteProgram(this->program);
 }
 
-GLuint Program::createShader(GLenum type, std::string shaderSource, std::string id)
+std::string Program::prepareShaderSource(std::string source, std::string id)
 {
     std::stringstream buffer;
+    buffer << versionShaderSource;
+    if(this->engine->params.contains("PACKED_INPUT"))
+        buffer << "#define PACKED_INPUT" << std::endl;
+    buffer << "#define DRAW_COMMANDS " << this->engine->getDrawCommandCapacity() << "u" << std::endl;
     buffer << engineShaderSource;
     buffer << mathShaderSource;
+    buffer << "#define PROGRAM_INDEX " << std::to_string(this->index) << "u" << std::endl;
     buffer << "#define PROGRAM_" << std::to_string(this->index) << std::endl;
     buffer << "#define PROGRAM_" << std::to_string(this->index) << "_" << id << std::endl;
-    buffer << shaderSource;
+    buffer << source;
 
-    auto string = buffer.str();
-    auto source = string.c_str();
+    return buffer.str();
+}
+
+GLuint Program::createShader(GLenum type, const std::string &shaderSource, const char *id)
+{
+    auto source = shaderSource.c_str();
 
-    this->engine->print("- Found %s shader, compiling...\n", id.c_str());
+    this->engine->print("- Found %s shader, compiling...\n", id);
+    auto traceBegin = this->engine->tracer.now();
 
+    // Compile status is checked only after linking, so driver can compile in background
     auto shader = glCreateShader(type);
     glShaderSource(shader, 1, &source, NULL);
     glCompileShader(shader);
 
-    // Check if shader was compiled successfully
-    GLint compileStatus;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
-    if(compileStatus == GL_FALSE)
-    {
-        char error[512];
-        glGetShaderInfoLog(shader, 512, NULL, error);
-        throw std::runtime_error("Failed to compile shader, Reason: " + std::string(error));
-    }
-
+    this->engine->tracer.record(id, traceBegin, this->index);
     return shader;
 }
 
-void Program::compile(std::string source)
+void Program::compile(const std::string &source, const std::set<std::string> &stages, const std::map<std::string, GLenum> &access)
+{
+    this->prepare(source, stages);
+    this->submit();
+    this->finish(access);
+}
+
+void Program::prepare(const std::string &source, const std::set<std::string> &stages)
 {
     if(this->program != 0)
         throw std::runtime_error("Program was already compiled");
 
     if(this->params.contains("ONCE"))
         this->isRanOnce = true;
-        
-    // Compile shaders that are part of the program
-    if(source.find("#ifdef PROGRAM_" + std::to_string(this->index) + "_COMPUTE_SHADER") != std::string::npos)
-        this->shaders[GL_COMPUTE_SHADER] = this->createShader(GL_COMPUTE_SHADER, source, "COMPUTE_SHADER");
 
-    if(source.find("#ifdef PROGRAM_" + std::to_string(this->index) + "_VERTEX_SHADER") != std::string::npos)
-        this->shaders[GL_VERTEX_SHADER] = this->createShader(GL_VERTEX_SHADER, source, "VERTEX_SHADER");
+    auto name = "PROGRAM_" + std::to_string(this->index);
+    if(this->params.contains("EVERY"))
+    {
+        long every = 0;
+        std::istringstream stream(this->params["EVERY"]);
+        if(!(stream >> every) || every <= 0)
+            throw std::runtime_error("Invalid EVERY param in " + name);
+        this->every = every;
+    }
+
+    if(this->params.contains("RATE"))
+    {
+        double rate = 0;
+        std::istringstream stream(this->params["RATE"]);
+        if(!(stream >> rate) || rate <= 0)
+            throw std::runtime_error("Invalid RATE param in " + name);
+        this->period = 1.0 / rate;
+    }
+
+    if(this->params.contains("FIXED_STEP"))
+    {
+        if(!this->engine->params.contains("FIXED_STEP"))
+            throw std::runtime_error("FIXED_STEP param of " + name + " requires global FIXED_STEP param");
+        this->isFixedStep = true;
+    }
+
+    if((this->every > 1) + (this->period > 0) + this->isFixedStep > 1)
+        throw std::runtime_error("Only one of EVERY, RATE and FIXED_STEP params can be used in " + name);
+
+    static const std::tuple<GLenum, const char*> types[] = {
+        {GL_COMPUTE_SHADER, "COMPUTE_SHADER"},
+        {GL_VERTEX_SHADER, "VERTEX_SHADER"},
+        {GL_FRAGMENT_SHADER, "FRAGMENT_SHADER"},
+        {GL_GEOMETRY_SHADER, "GEOMETRY_SHADER"},
+        {GL_TESS_CONTROL_SHADER, "TESS_CONTROL_SHADER"},
+        {GL_TESS_EVALUATION_SHADER, "TESS_EVALUATION_SHADER"}
+    };
+
+    // Prepare sources of shaders that are part of the program
+    this->sourceHash = Utils::hash("");
+    for(auto const& [type, id] : types)
+    {
+        if(!stages.contains(id))
+            continue;
+
+        auto shaderSource = this->prepareShaderSource(source, id);
+        this->sourceHash = Utils::hash(std::to_string(type), this->sourceHash);
+        this->sourceHash = Utils::hash(shaderSource, this->sourceHash);
+        this->sources[type] = std::make_tuple(id, std::move(shaderSource));
+        this->stages.insert(type);
+    }
+}
 
-    if(source.find("#ifdef PROGRAM_" + std::to_string(this->index) + "_FRAGMENT_SHADER") != std::string::npos)
-        this->shaders[GL_FRAGMENT_SHADER] = this->createShader(GL_FRAGMENT_SHADER, source, "FRAGMENT_SHADER");
+void Program::submit()
+{
+    this->program = glCreateProgram();
+    this->cachePath = this->getCachePath();
 
-    if(source.find("#ifdef PROGRAM_" + std::to_string(this->index) + "_GEOMETRY_SHADER") != std::string::npos)
-        this->shaders[GL_GEOMETRY_SHADER] = this->createShader(GL_GEOMETRY_SHADER, source, "GEOMETRY_SHADER");
+    // Compile shaders only if program binary is not cached
+    auto traceBegin = this->engine->tracer.now();
+    this->isCached = this->loadProgramBinary(this->program, this->cachePath);
+    this->engine->tracer.record("load binary", traceBegin, this->index);
 
-    if(source.find("#ifdef PROGRAM_" + std::to_string(this->index) + "_TESS_CONTROL_SHADER") != std::string::npos)
-        this->shaders[GL_TESS_CONTROL_SHADER] = this->createShader(GL_TESS_CONTROL_SHADER, source, "TESS_CONTROL_SHADER");
+    if(!this->isCached)
+    {
+        for(auto const& [type, shader] : this->sources)
+            this->shaders[type] = this->createShader(type, std::get<1>(shader), std::get<0>(shader));
+
+        traceBegin = this->engine->tracer.now();
+        glProgramParameteri(this->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        for(const auto &x : this->shaders)
+            glAttachShader(this->program, x.second);
+        glLinkProgram(this->program);
+        this->engine->tracer.record("link", traceBegin, this->index);
+    }
 
-    if(source.find("#ifdef PROGRAM_" + std::to_string(this->index) + "_TESS_EVALUATION_SHADER") != std::string::npos)
-        this->shaders[GL_TESS_EVALUATION_SHADER] = this->createShader(GL_TESS_EVALUATION_SHADER, source, "TESS_EVALUATION_SHADER");
+    this->sources.clear();
+}
 
-    auto program = glCreateProgram();
-    for(const auto &x : this->shaders)
-        glAttachShader(program, x.second);
-    glLinkProgram(program);
-    
-    // Check if program was linked successfully
+void Program::finish(const std::map<std::string, GLenum> &access)
+{
+    auto program = this->program;
+
+    // Check if program was linked successfully, this waits for the driver
+    auto traceBegin = this->engine->tracer.now();
     GLint linkStatus;
     glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    this->engine->tracer.record("wait for link", traceBegin, this->index);
     if(linkStatus == GL_FALSE)
     {
+        // Failed compilation is more useful to report than the link error it caused
+        for(auto const& [type, shader] : this->shaders)
+        {
+            GLint compileStatus;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+            if(compileStatus == GL_FALSE)
+            {
+                char error[512];
+                glGetShaderInfoLog(shader, 512, NULL, error);
+                throw std::runtime_error("Failed to compile shader, Reason: " + std::string(error));
+            }
+        }
+
         char buffer[1024];
         glGetProgramInfoLog(program, 1024, 0, buffer);
         throw std::runtime_error("Failed to link program, Reason: " + std::string(buffer));
     }
 
+    if(!this->isCached)
+        this->saveProgramBinary(program, this->cachePath);
+
     // Check if program was validated successfully
     GLint validateStatus;
     glValidateProgram(program);
@@ -112,13 +205,155 @@ void Program::compile(std::string source)
     if(validateStatus == GL_FALSE)
         throw std::runtime_error("Failed to validate program");
 
-    this->program = program;
-
     // Parse programs for additional information
-    this->parseProgramUniforms();
+    traceBegin = this->engine->tracer.now();
+    this->parseProgramUniforms(access);
     this->parseProgramOutputs();
-    this->parseProgramBuffers();
+    this->parseProgramBuffers(access);
     this->parseProgramInputs();
+    this->parseProgramDispatch();
+    this->parseProgramPredicate();
+    this->engine->tracer.record("reflection", traceBegin, this->index);
+}
+
+void Program::parseProgramPredicate()
+{
+    if(!this->params.contains("ENABLE_IF"))
+        return;
+
+    // Variable is reflected as Block.member, so the program has to declare the buffer
+    auto name = "PROGRAM_" + std::to_string(this->index);
+    auto variable = this->params["ENABLE_IF"];
+    auto separator = variable.find('.');
+    auto buffer = variable.substr(0, separator);
+
+    auto resource = glGetProgramResourceIndex(this->program, GL_BUFFER_VARIABLE, variable.c_str());
+    if(separator == std::string::npos || resource == GL_INVALID_INDEX || !this->engine->buffers.contains(buffer))
+        throw std::runtime_error("Buffer variable referenced in ENABLE_IF param of " + name + " is not used by the program");
+
+    GLenum props[2] = {GL_OFFSET, GL_TYPE};
+    GLint values[2] = {0};
+    glGetProgramResourceiv(this->program, GL_BUFFER_VARIABLE, resource, 2, props, 2, nullptr, values);
+
+    if(values[1] != GL_UNSIGNED_INT && values[1] != GL_INT && values[1] != GL_BOOL)
+        throw std::runtime_error("Buffer variable referenced in ENABLE_IF param of " + name + " must be uint, int or bool");
+
+    this->predicate = std::make_tuple(this->engine->buffers[buffer], values[0] / sizeof(GLuint));
+}
+
+GLuint Program::createPredicateProgram()
+{
+    const char *sources[] = {versionShaderSource, predicateShaderSource};
+    auto program = glCreateShaderProgramv(GL_COMPUTE_SHADER, 2, sources);
+
+    GLint linkStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    if(linkStatus == GL_FALSE)
+    {
+        char buffer[1024];
+        glGetProgramInfoLog(program, 1024, 0, buffer);
+        glDeleteProgram(program);
+        throw std::runtime_error("Failed to link predicate program, Reason: " + std::string(buffer));
+    }
+
+    return program;
+}
+
+void Program::parseProgramDispatch()
+{
+    bool isFixed = this->params.contains("DISPATCH");
+    bool isDerived = this->params.contains("DISPATCH_FOR");
+    bool isIterated = this->params.contains("ITERATIONS");
+    if(!isFixed && !isDerived && !isIterated)
+        return;
+
+    auto name = "PROGRAM_" + std::to_string(this->index);
+    if(!this->isCompute())
+        throw std::runtime_error("Dispatch param is used in " + name + " which is not a compute program");
+
+    if(isIterated)
+    {
+        long iterations = 0;
+        std::istringstream stream(this->params["ITERATIONS"]);
+        if(!(stream >> iterations) || iterations <= 0)
+            throw std::runtime_error("Invalid ITERATIONS param in " + name);
+
+        this->iterations = iterations;
+    }
+
+    if(!isFixed && !isDerived)
+        return;
+
+    if(isFixed && isDerived)
+        throw std::runtime_error("DISPATCH and DISPATCH_FOR params are both used in " + name);
+
+    // Missing dimensions are one work group, same as in glDispatchCompute
+    long size[3] = {1, 1, 1};
+
+    if(isFixed)
+    {
+        std::istringstream stream(this->params["DISPATCH"]);
+        long value;
+        int count = 0;
+        for(; stream >> value; count++)
+        {
+            if(count == 3)
+                throw std::runtime_error("Invalid DISPATCH param in " + name);
+            size[count] = value;
+        }
+
+        // At least the first dimension has to be given
+        if(!stream.eof() || count == 0)
+            throw std::runtime_error("Invalid DISPATCH param in " + name);
+    }
+    else
+    {
+        // One invocation per texel of the texture, or per stride bytes of the buffer (4 by default)
+        std::string resource;
+        long stride = 4;
+        std::istringstream stream(this->params["DISPATCH_FOR"]);
+        if(!(stream >> resource))
+            throw std::runtime_error("Invalid DISPATCH_FOR param in " + name);
+
+        if(!(stream >> std::ws).eof() && (!(stream >> stride) || stride <= 0 || !(stream >> std::ws).eof()))
+            throw std::runtime_error("Invalid stride in DISPATCH_FOR param of " + name);
+
+        GLint groupSize[3];
+        glGetProgramiv(this->program, GL_COMPUTE_WORK_GROUP_SIZE, groupSize);
+
+        long invocations[3] = {1, 1, 1};
+        if(this->engine->textures.contains(resource))
+        {
+            GLint width, height;
+            glGetTextureLevelParameteriv(this->engine->textures[resource], 0, GL_TEXTURE_WIDTH, &width);
+            glGetTextureLevelParameteriv(this->engine->textures[resource], 0, GL_TEXTURE_HEIGHT, &height);
+            invocations[0] = width;
+            invocations[1] = height;
+        }
+        else if(this->engine->bufferSizes.contains(resource))
+        {
+            invocations[0] = (this->engine->bufferSizes[resource] + stride - 1) / stride;
+        }
+        else
+        {
+            throw std::runtime_error("Resource referenced in DISPATCH_FOR param of " + name + " does not exist");
+        }
+
+        for(int i = 0; i < 3; i++)
+            size[i] = (invocations[i] + groupSize[i] - 1) / groupSize[i];
+    }
+
+    GLint maxCount[3];
+    for(int i = 0; i < 3; i++)
+    {
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &maxCount[i]);
+        if(size[i] <= 0 || size[i] > maxCount[i])
+            throw std::runtime_error("Dispatch size of " + name + " is out of range");
+
+        this->dispatchSize[i] = size[i];
+    }
+
+    this->engine->print("- Dispatching %u x %u x %u work groups\n", this->dispatchSize[0], this->dispatchSize[1], this->dispatchSize[2]);
 }
 
 void Program::parseProgramInputs()
@@ -221,10 +456,11 @@ void Program::parseProgramOutputs()
     {
         auto texture = this->engine->createTexture(name);
         glNamedFramebufferTexture(this->framebuffer, GL_COLOR_ATTACHMENT0 + index, texture, 0);
+        this->outputs.push_back(texture);
     }
 }
 
-void Program::parseProgramUniforms()
+void Program::parseProgramUniforms(const std::map<std::string, GLenum> &access)
 {
     GLint uniformCount;
     glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
@@ -238,16 +474,29 @@ void Program::parseProgramUniforms()
 
         glGetActiveUniform(program, i, 200, &length, &size, &type, buffer);
 
+        // Iteration index is set by engine before every dispatch
+        if(strcmp(buffer, "engineIteration") == 0)
+        {
+            this->iterationLocation = glGetUniformLocation(program, buffer);
+            continue;
+        }
+
         if(type != GL_SAMPLER_2D && type != GL_IMAGE_2D)
             throw std::runtime_error("Unsupported uniform type");
 
+        // Uniform is assigned to its unit only once, units do not change between frames
+        auto unit = static_cast<GLuint>(this->textures.size());
         auto location = glGetUniformLocation(program, buffer);
+        glProgramUniform1i(program, location, unit);
+
+        // Samplers can be only read, access of images is given by their qualifiers
         auto texture = this->engine->createTexture(std::string(buffer));
-        this->textures.push_back(std::make_tuple(texture, type, location));
+        auto mode = type == GL_IMAGE_2D ? getAccess(access, "image2D " + std::string(buffer)) : GL_READ_ONLY;
+        this->textures.push_back(std::make_tuple(texture, type, unit, mode));
     }
 }
 
-void Program::parseProgramBuffers()
+void Program::parseProgramBuffers(const std::map<std::string, GLenum> &access)
 {
     GLint bufferCount;
     glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &bufferCount);
@@ -261,15 +510,39 @@ void Program::parseProgramBuffers()
         glGetProgramResourceName(program, GL_SHADER_STORAGE_BLOCK, i, 201, nullptr, buffer);
         glGetProgramResourceiv(program, GL_SHADER_STORAGE_BLOCK, i, 2, props, 2, nullptr, params);
 
-        // Skip builtin buffers
-        if(strcmp(buffer, "EngineBuffer") == 0 || strcmp(buffer, "DrawCommandBuffer") == 0 ||
-           strcmp(buffer, "WorkGroupBuffer") == 0)
+        // Engine buffer is written only by engine
+        if(strcmp(buffer, "EngineBuffer") == 0)
             continue;
 
-        this->buffers.push_back(std::make_tuple(engine->createBuffer(buffer, params[1]), params[0]));
+        // Builtin buffers are owned by engine, only their access is needed
+        if(strcmp(buffer, "DrawCommandBuffer") == 0 || strcmp(buffer, "WorkGroupBuffer") == 0)
+        {
+            static auto builtinAccess = Parser::parse(engineShaderSource).access;
+            this->builtinBuffers[buffer] = getAccess(builtinAccess, "buffer " + std::string(buffer));
+            continue;
+        }
+
+        auto mode = getAccess(access, "buffer " + std::string(buffer));
+        this->buffers.push_back(std::make_tuple(engine->createBuffer(buffer, params[1]), params[0], mode));
     }
 }
 
+GLenum Program::getAccess(const std::map<std::string, GLenum> &access, const std::string &declaration)
+{
+    auto it = access.find(declaration);
+    return it != access.end() ? it->second : GL_READ_WRITE;
+}
+
+int Program::getIndex()
+{
+    return this->index;
+}
+
+uint64_t Program::getSourceHash()
+{
+    return this->sourceHash;
+}
+
 GLuint Program::getProgramId()
 {
     return this->program;
@@ -280,6 +553,56 @@ GLuint Program::getFramebufferId()
     return this->framebuffer;
 }
 
+const GLuint *Program::getDispatchSize()
+{
+    return this->dispatchSize;
+}
+
+void Program::replaceTexture(GLuint texture, GLuint replacement)
+{
+    for(auto &[id, type, unit, access] : this->textures)
+        if(id == texture)
+            id = replacement;
+
+    for(size_t i = 0; i < this->outputs.size(); i++)
+    {
+        if(this->outputs[i] != texture)
+            continue;
+
+        // Attachment point is not stored, so it is found by the attached texture
+        GLint attachments;
+        glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &attachments);
+        for(GLint j = 0; j < attachments; j++)
+        {
+            GLint attached = 0;
+            glGetNamedFramebufferAttachmentParameteriv(this->framebuffer, GL_COLOR_ATTACHMENT0 + j, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &attached);
+            if(static_cast<GLuint>(attached) == texture)
+                glNamedFramebufferTexture(this->framebuffer, GL_COLOR_ATTACHMENT0 + j, replacement, 0);
+        }
+
+        this->outputs[i] = replacement;
+    }
+
+    // Dispatch size might be derived from the texture size
+    if(this->params.contains("DISPATCH_FOR"))
+        this->parseProgramDispatch();
+}
+
+std::tuple<GLuint, GLuint> Program::getPredicate()
+{
+    return this->predicate;
+}
+
+GLuint Program::getIterations()
+{
+    return this->iterations;
+}
+
+GLint Program::getIterationLocation()
+{
+    return this->iterationLocation;
+}
+
 GLuint Program::getVertexArrayId()
 {
     return this->varray;
@@ -287,5 +610,113 @@ GLuint Program::getVertexArrayId()
 
 bool Program::isCompute()
 {
-    return this->shaders.contains(GL_COMPUTE_SHADER);
+    return this->stages.contains(GL_COMPUTE_SHADER);
+}
+
+std::string Program::getCachePath()
+{
+    if(this->engine->cacheDirectory.empty())
+        return "";
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if(formats == 0)
+        return "";
+
+    // Binary is valid only for the same sources and the same driver
+    auto hash = Utils::hash((const char *) glGetString(GL_VENDOR));
+    hash = Utils::hash((const char *) glGetString(GL_RENDERER), hash);
+    hash = Utils::hash((const char *) glGetString(GL_VERSION), hash);
+    hash = Utils::hash(std::to_string(this->sourceHash), hash);
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long) hash);
+    return (std::filesystem::path(this->engine->cacheDirectory) / (std::string(name) + ".bin")).string();
+}
+
+bool Program::loadProgramBinary(GLuint program, const std::string &path)
+{
+    if(path.empty())
+        return false;
+
+    std::ifstream stream(path, std::ios::binary);
+    if(stream.fail())
+        return false;
+
+    GLenum format;
+    stream.read(reinterpret_cast<char*>(&format), sizeof(format));
+    std::vector<char> binary((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    if(stream.bad() || binary.empty())
+        return false;
+
+    // Driver may reject the binary, for example after driver update
+    glProgramBinary(program, format, binary.data(), binary.size());
+
+    GLint linkStatus;
+    glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+    if(linkStatus == GL_FALSE)
+    {
+        this->engine->print("- Cached program binary was rejected, compiling...\n");
+        return false;
+    }
+
+    // Modification time marks recently used binaries, so they are kept when the cache is pruned
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+
+    this->engine->print("- Loaded cached program binary\n");
+    return true;
+}
+
+void Program::saveProgramBinary(GLuint program, const std::string &path)
+{
+    if(path.empty())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length == 0)
+        return;
+
+    GLenum format;
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    // Write into temporary file first, so concurrent runs never read partial binary
+    std::error_code error;
+    auto temporary = path + ".tmp" + std::to_string(std::random_device()());
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+    std::ofstream stream(temporary, std::ios::binary);
+    stream.write(reinterpret_cast<char*>(&format), sizeof(format));
+    stream.write(binary.data(), binary.size());
+    stream.close();
+
+    if(stream.fail())
+    {
+        std::filesystem::remove(temporary, error);
+        return;
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if(!error)
+        pruneCache(std::filesystem::path(path).parent_path());
+}
+
+void Program::pruneCache(const std::filesystem::path &directory)
+{
+    std::error_code error;
+    std::vector<std::tuple<std::filesystem::file_time_type, std::filesystem::path>> entries;
+    for(auto const& entry : std::filesystem::directory_iterator(directory, error))
+        if(entry.path().extension() == ".bin")
+            entries.push_back(std::make_tuple(entry.last_write_time(error), entry.path()));
+
+    if(entries.size() <= maxCacheEntries)
+        return;
+
+    // Oldest binaries are removed first
+    std::sort(entries.begin(), entries.end());
+    for(size_t i = 0; i < entries.size() - maxCacheEntries; i++)
+        std::filesystem::remove(std::get<1>(entries[i]), error);
 }
\ No newline at end of file
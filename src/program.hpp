@@ -2,9 +2,12 @@
 #define PROGRAM_H
 
 #include <map>
+#include <set>
 #include <tuple>
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <filesystem>
 
 #include <GL/glew.h>
 
@@ -26,18 +29,51 @@ public:
     //! Program destructor
     ~Program();
 
-    //! Compile program with provided source
-    void compile(std::string source);
+    /*!
+     * @brief Compile program with provided source
+     * @param source Shader file source
+     * @param stages Shader stages of the program present in source
+     * @param access Access of resources declared in source
+     */
+    void compile(const std::string &source, const std::set<std::string> &stages, const std::map<std::string, GLenum> &access);
+
+    /*!
+     * @brief Prepare shader sources, does not use OpenGL so it can run on any thread
+     * @param source Shader file source
+     * @param stages Shader stages of the program present in source
+     */
+    void prepare(const std::string &source, const std::set<std::string> &stages);
+
+    //! Submit compilation and linking of prepared shaders without waiting for the result
+    void submit();
 
-    //! List of program's textures, it's type and location
-    std::vector<std::tuple<GLuint, GLenum, GLuint>> textures;
+    /*!
+     * @brief Wait for the submitted program and parse it's information
+     * @param access Access of resources declared in source
+     */
+    void finish(const std::map<std::string, GLenum> &access);
 
-    //! List of program's buffers and it's binding points
-    std::vector<std::tuple<GLuint, int>> buffers;
+    //! List of program's textures, it's type, assigned unit and access
+    std::vector<std::tuple<GLuint, GLenum, GLuint, GLenum>> textures;
+
+    //! List of program's buffers, it's binding points and access
+    std::vector<std::tuple<GLuint, int, GLenum>> buffers;
+
+    //! List of textures attached to program's custom framebuffer
+    std::vector<GLuint> outputs;
+
+    //! Access of built-in buffers used by the program
+    std::map<std::string, GLenum> builtinBuffers;
 
     //! List of program's params
     std::map<std::string, std::string> params;
 
+    //! Get index of the program
+    int getIndex();
+
+    //! Get hash of the prepared shader sources
+    uint64_t getSourceHash();
+
     //! Get OpenGL program ID
     GLuint getProgramId();
 
@@ -46,7 +82,31 @@ public:
 
     //! Get OpenGL vertex array ID
     GLuint getVertexArrayId();
-    
+
+    //! Get number of work groups of direct dispatch, all zero if dispatch is indirect
+    const GLuint *getDispatchSize();
+
+    /*!
+     * @brief Use another texture instead of the one that was replaced, including framebuffer attachments
+     * @param texture OpenGL ID of the replaced texture
+     * @param replacement OpenGL ID of the new texture
+     */
+    void replaceTexture(GLuint texture, GLuint replacement);
+
+    //! Get buffer and offset of the value enabling the program (in 4 byte words), buffer is 0 if not predicated
+    std::tuple<GLuint, GLuint> getPredicate();
+
+    /*!
+     * @brief Create built-in program that writes indirect arguments of predicated programs
+     * @return OpenGL program ID
+     */
+    static GLuint createPredicateProgram();
+
+    //! Get number of dispatches per frame, set by ITERATIONS param
+    GLuint getIterations();
+
+    //! Get location of the iteration index uniform, -1 if the program does not use it
+    GLint getIterationLocation();
 
     //! Whether the program contains compute shader
     bool isCompute();
@@ -56,6 +116,15 @@ public:
 
     //! Whether the program should run only once
     bool isRanOnce = false;
+
+    //! Number of frames between runs, set by EVERY param
+    GLuint every = 1;
+
+    //! Minimal time between runs in seconds, set by RATE param
+    double period = 0;
+
+    //! Whether the program runs once per elapsed fixed time step, set by FIXED_STEP param
+    bool isFixedStep = false;
 private:
     //! Engine instance
     Engine *engine;
@@ -66,6 +135,33 @@ private:
     //! Map of compiled shaders by it's type
     std::map<GLenum, GLuint> shaders;
 
+    //! Shader stages that are part of the program
+    std::set<GLenum> stages;
+
+    //! Prepared shader identificators and sources by their type
+    std::map<GLenum, std::tuple<const char*, std::string>> sources;
+
+    //! Hash of the prepared shader sources
+    uint64_t sourceHash = 0;
+
+    //! Path of the cached program binary
+    std::string cachePath;
+
+    //! Whether the program was loaded from cache
+    bool isCached = false;
+
+    //! Number of work groups set by DISPATCH or DISPATCH_FOR param
+    GLuint dispatchSize[3] = {0, 0, 0};
+
+    //! Buffer and word offset of the value set by ENABLE_IF param
+    std::tuple<GLuint, GLuint> predicate = {0, 0};
+
+    //! Number of dispatches per frame
+    GLuint iterations = 1;
+
+    //! Location of the iteration index uniform
+    GLint iterationLocation = -1;
+
     //! Parse program inputs and generate vertex array
     void parseProgramInputs();
 
@@ -73,10 +169,62 @@ private:
     void parseProgramOutputs();
 
     //! Parse program uniforms and generate textures
-    void parseProgramUniforms();
+    void parseProgramUniforms(const std::map<std::string, GLenum> &access);
     
     //! Parse program buffers and generate buffer objects
-    void parseProgramBuffers();
+    void parseProgramBuffers(const std::map<std::string, GLenum> &access);
+
+    //! Compute direct dispatch size from DISPATCH or DISPATCH_FOR param, and iterations from ITERATIONS param
+    void parseProgramDispatch();
+
+    //! Find buffer variable referenced by ENABLE_IF param
+    void parseProgramPredicate();
+
+    /*!
+     * @brief Get access of the resource
+     * @param access Access of resources by their declaration
+     * @param declaration Declaration of the resource, for example "buffer Name"
+     * @return GL_READ_ONLY, GL_WRITE_ONLY or GL_READ_WRITE if access is not known
+     */
+    static GLenum getAccess(const std::map<std::string, GLenum> &access, const std::string &declaration);
+
+    /*!
+     * @brief Prepare complete source of the program's shader
+     * @param source Program source
+     * @param id Shader GLSL identificator
+     * @return Shader source with engine sources and defines
+     */
+    std::string prepareShaderSource(std::string source, std::string id);
+
+    /*!
+     * @brief Get path of the cached program binary
+     * @return Path of the cached binary, empty if caching is not possible
+     */
+    std::string getCachePath();
+
+    /*!
+     * @brief Load cached program binary
+     * @param program OpenGL program ID
+     * @param path Path of the cached binary
+     * @return Whether the program was successfully loaded
+     */
+    bool loadProgramBinary(GLuint program, const std::string &path);
+
+    /*!
+     * @brief Save program binary to cache
+     * @param program OpenGL program ID
+     * @param path Path of the cached binary
+     */
+    void saveProgramBinary(GLuint program, const std::string &path);
+
+    //! Maximal number of cached program binaries, the least recently used are removed
+    static const size_t maxCacheEntries = 256;
+
+    /*!
+     * @brief Remove least recently used binaries over the limit from the cache
+     * @param directory Cache directory
+     */
+    static void pruneCache(const std::filesystem::path &directory);
 
     /*!
      * @brief Create and compile shader of the program
@@ -85,7 +233,7 @@ private:
      * @param id Shader GLSL identificator
      * @return OpenGL shader ID
      */
-    GLuint createShader(GLenum type, std::string shaderSource, std::string id);
+    GLuint createShader(GLenum type, const std::string &shaderSource, const char *id);
 
     //! OpenGL program ID
     GLuint program = 0;
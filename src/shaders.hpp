@@ -1,11 +1,12 @@
 #ifndef SHADER_H
 #define SHADER_H
 
-const char *engineShaderSource = R"(
-#version 460 core
+const char *versionShaderSource = R"(#version 460 core
 
 #extension GL_ARB_shader_ballot : enable
+)";
 
+const char *engineShaderSource = R"(
 #define KEY_SPACE              32
 #define KEY_APOSTROPHE         39
 #define KEY_COMMA              44
@@ -144,6 +145,7 @@ const char *engineShaderSource = R"(
 #define STATE_RELEASED 0
 #define STATE_PRESSED 1
 
+#ifdef PACKED_INPUT
 layout(std430, binding = 0) buffer EngineBuffer {
     int width;
     int height;
@@ -151,6 +153,39 @@ layout(std430, binding = 0) buffer EngineBuffer {
     double deltaTime;
     int mouseX;
     int mouseY;
+    float stepAlpha;
+    float resolutionScale;
+    uint mouse;
+    uint mouseEdge;
+    uint keys[KEY_LAST / 32 + 1];
+    uint keysEdge[KEY_LAST / 32 + 1];
+} engineBuffer;
+
+bool key_pressed(uint key) {
+    return (engineBuffer.keys[key >> 5] & (1u << (key & 31))) != 0;
+}
+
+bool mouse_pressed(uint key) {
+    return (engineBuffer.mouse & (1u << key)) != 0;
+}
+
+bool key_pressed_now(uint key) {
+    return (engineBuffer.keysEdge[key >> 5] & (1u << (key & 31))) != 0;
+}
+
+bool mouse_pressed_now(uint key) {
+    return (engineBuffer.mouseEdge & (1u << key)) != 0;
+}
+#else
+layout(std430, binding = 0) buffer EngineBuffer {
+    int width;
+    int height;
+    double currentTime;
+    double deltaTime;
+    int mouseX;
+    int mouseY;
+    float stepAlpha;
+    float resolutionScale;
     int mouse[MOUSE_BUTTON_LAST];
     int keys[KEY_LAST];
 } engineBuffer;
@@ -162,13 +197,36 @@ bool key_pressed(uint key) {
 bool mouse_pressed(uint key) {
     return engineBuffer.mouse[key] == STATE_PRESSED;
 }
+#endif
 
-layout(std430, binding = 1) buffer WorkGroupBuffer {
+// Index of the current iteration of program with ITERATIONS param
+uniform uint engineIteration;
+
+struct DispatchCommand {
     uint x;
     uint y;
-    uint z; 
+    uint z;
+};
+
+// Frame request of ON_DEMAND mode and dispatch size of each compute program, indexed by program index
+layout(std430, binding = 1) buffer WorkGroupBuffer {
+    uint frameRequested;
+    DispatchCommand dispatches[];
 } workGroupBuffer;
 
+// Render another frame in ON_DEMAND mode even if input does not change
+void request_frame()
+{
+    workGroupBuffer.frameRequested = 1;
+}
+
+void set_dispatch(uint program, uint x, uint y, uint z)
+{
+    workGroupBuffer.dispatches[program].x = x;
+    workGroupBuffer.dispatches[program].y = y;
+    workGroupBuffer.dispatches[program].z = z;
+}
+
 struct DrawCommand {
     uint count;
     uint instanceCount;
@@ -177,17 +235,80 @@ struct DrawCommand {
     uint baseInstance;
 };
 
-layout(std430, binding = 2) writeonly buffer DrawCommandBuffer {
-    DrawCommand commands[100];
+struct DrawCommandRange {
+    uint drawCount;
+    DrawCommand commands[DRAW_COMMANDS];
+};
+
+// Draw count and draw commands of each draw program, indexed by program index
+layout(std430, binding = 2) buffer DrawCommandBuffer {
+    DrawCommandRange programs[];
 } drawCommandBuffer;
 
-void set_drawcommand(uint offset, uint count, uint instances, uint firstIndex, uint baseVertex, uint baseInstance)
+void set_drawcommand(uint program, uint offset, uint count, uint instances, uint firstIndex, uint baseVertex, uint baseInstance)
+{
+    drawCommandBuffer.programs[program].commands[offset].count = count;
+    drawCommandBuffer.programs[program].commands[offset].instanceCount = instances;
+    drawCommandBuffer.programs[program].commands[offset].firstIndex = firstIndex;
+    drawCommandBuffer.programs[program].commands[offset].baseVertex = baseVertex;
+    drawCommandBuffer.programs[program].commands[offset].baseInstance = baseInstance;
+    atomicMax(drawCommandBuffer.programs[program].drawCount, offset + 1);
+}
+
+void set_drawcount(uint program, uint count)
+{
+    drawCommandBuffer.programs[program].drawCount = count;
+}
+
+// Returns offset of the appended command, or DRAW_COMMANDS if the range is full
+uint append_drawcommand(uint program, uint count, uint instances, uint firstIndex, uint baseVertex, uint baseInstance)
+{
+    uint offset = atomicAdd(drawCommandBuffer.programs[program].drawCount, 1);
+    if(offset >= DRAW_COMMANDS)
+    {
+        atomicMin(drawCommandBuffer.programs[program].drawCount, DRAW_COMMANDS);
+        return DRAW_COMMANDS;
+    }
+
+    drawCommandBuffer.programs[program].commands[offset].count = count;
+    drawCommandBuffer.programs[program].commands[offset].instanceCount = instances;
+    drawCommandBuffer.programs[program].commands[offset].firstIndex = firstIndex;
+    drawCommandBuffer.programs[program].commands[offset].baseVertex = baseVertex;
+    drawCommandBuffer.programs[program].commands[offset].baseInstance = baseInstance;
+    return offset;
+}
+)";
+
+const char *predicateShaderSource = R"(
+layout(local_size_x = 1) in;
+
+layout(std430, binding = 1) readonly buffer WorkGroupBuffer {
+    uint frameRequested;
+    uint dispatches[];
+};
+
+layout(std430, binding = 2) readonly buffer DrawCommandBuffer {
+    uint draws[];
+};
+
+layout(std430, binding = 3) readonly buffer PredicateSource {
+    uint values[];
+};
+
+layout(std430, binding = 4) writeonly buffer PredicateBuffer {
+    uvec4 arguments[];
+};
+
+layout(location = 0) uniform uint valueOffset;
+layout(location = 1) uniform uint program;
+layout(location = 2) uniform uint drawCountOffset;
+layout(location = 3) uniform uvec3 dispatchSize;
+
+// Copy dispatch size and draw count of the program, or zeros if the program is disabled
+void main()
 {
-    drawCommandBuffer.commands[offset].count = count;
-    drawCommandBuffer.commands[offset].instanceCount = instances;
-    drawCommandBuffer.commands[offset].firstIndex = firstIndex;
-    drawCommandBuffer.commands[offset].baseVertex = baseVertex;
-    drawCommandBuffer.commands[offset].baseInstance = baseInstance;
+    uvec3 size = dispatchSize.x != 0 ? dispatchSize : uvec3(dispatches[program * 3], dispatches[program * 3 + 1], dispatches[program * 3 + 2]);
+    arguments[program] = values[valueOffset] != 0 ? uvec4(size, draws[drawCountOffset]) : uvec4(0);
 }
 )";
 
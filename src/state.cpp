@@ -0,0 +1,93 @@
+#include "state.hpp"
+
+#include <GL/glew.h>
+
+void StateCache::useProgram(GLuint program)
+{
+    if(this->program == program)
+        return;
+
+    glUseProgram(program);
+    this->program = program;
+}
+
+void StateCache::bindVertexArray(GLuint varray)
+{
+    if(this->varray == varray)
+        return;
+
+    glBindVertexArray(varray);
+    this->varray = varray;
+}
+
+void StateCache::bindFramebuffer(GLuint framebuffer)
+{
+    if(this->framebuffer == framebuffer)
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    this->framebuffer = framebuffer;
+}
+
+void StateCache::setViewport(GLsizei width, GLsizei height)
+{
+    auto viewport = std::make_tuple(width, height);
+    if(this->viewport == viewport)
+        return;
+
+    glViewport(0, 0, width, height);
+    this->viewport = viewport;
+}
+
+void StateCache::bindStorageBuffer(GLuint point, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if(point >= this->storageBuffers.size())
+        this->storageBuffers.resize(point + 1, std::make_tuple(unknown, 0, 0));
+
+    auto binding = std::make_tuple(buffer, offset, size);
+    if(this->storageBuffers[point] == binding)
+        return;
+
+    if(size == 0)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, point, buffer);
+    else
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, point, buffer, offset, size);
+
+    this->storageBuffers[point] = binding;
+}
+
+void StateCache::bindImageTexture(GLuint unit, GLuint texture, GLenum access, GLenum format)
+{
+    if(unit >= this->imageTextures.size())
+        this->imageTextures.resize(unit + 1, std::make_tuple(unknown, 0, 0));
+
+    auto binding = std::make_tuple(texture, access, format);
+    if(this->imageTextures[unit] == binding)
+        return;
+
+    glBindImageTexture(unit, texture, 0, GL_FALSE, 0, access, format);
+    this->imageTextures[unit] = binding;
+}
+
+void StateCache::bindTextureUnit(GLuint unit, GLuint texture)
+{
+    if(unit >= this->textureUnits.size())
+        this->textureUnits.resize(unit + 1, unknown);
+
+    if(this->textureUnits[unit] == texture)
+        return;
+
+    glBindTextureUnit(unit, texture);
+    this->textureUnits[unit] = texture;
+}
+
+void StateCache::reset()
+{
+    this->program = unknown;
+    this->varray = unknown;
+    this->framebuffer = unknown;
+    this->viewport = {-1, -1};
+    this->storageBuffers.clear();
+    this->imageTextures.clear();
+    this->textureUnits.clear();
+}
@@ -0,0 +1,90 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <tuple>
+#include <vector>
+
+#include <GL/glew.h>
+
+class StateCache
+{
+public:
+    /*!
+     * @brief Use program if it is not already used
+     * @param program OpenGL program ID
+     */
+    void useProgram(GLuint program);
+
+    /*!
+     * @brief Bind vertex array if it is not already bound
+     * @param varray OpenGL vertex array ID
+     */
+    void bindVertexArray(GLuint varray);
+
+    /*!
+     * @brief Bind framebuffer if it is not already bound
+     * @param framebuffer OpenGL framebuffer ID
+     */
+    void bindFramebuffer(GLuint framebuffer);
+
+    /*!
+     * @brief Set viewport at the origin if it is not already set
+     * @param width Width of the viewport
+     * @param height Height of the viewport
+     */
+    void setViewport(GLsizei width, GLsizei height);
+
+    /*!
+     * @brief Bind shader storage buffer (or its range) to binding point if it is not already bound
+     * @param point Binding point
+     * @param buffer OpenGL buffer ID
+     * @param offset Offset of the bound range
+     * @param size Size of the bound range, whole buffer is bound if zero
+     */
+    void bindStorageBuffer(GLuint point, GLuint buffer, GLintptr offset = 0, GLsizeiptr size = 0);
+
+    /*!
+     * @brief Bind texture to image unit if it is not already bound
+     * @param unit Image unit
+     * @param texture OpenGL texture ID
+     * @param access Image access
+     * @param format Image format
+     */
+    void bindImageTexture(GLuint unit, GLuint texture, GLenum access, GLenum format);
+
+    /*!
+     * @brief Bind texture to texture unit if it is not already bound
+     * @param unit Texture unit
+     * @param texture OpenGL texture ID
+     */
+    void bindTextureUnit(GLuint unit, GLuint texture);
+
+    //! Forget all shadowed state, next calls will be always issued
+    void reset();
+private:
+    //! Value of state that is not known
+    static const GLuint unknown = ~0u;
+
+    //! Currently used program
+    GLuint program = unknown;
+
+    //! Currently bound vertex array
+    GLuint varray = unknown;
+
+    //! Currently bound framebuffer
+    GLuint framebuffer = unknown;
+
+    //! Current viewport size
+    std::tuple<GLsizei, GLsizei> viewport = {-1, -1};
+
+    //! Shader storage buffers, their offsets and sizes by binding point
+    std::vector<std::tuple<GLuint, GLintptr, GLsizeiptr>> storageBuffers;
+
+    //! Image textures, their access and format by image unit
+    std::vector<std::tuple<GLuint, GLenum, GLenum>> imageTextures;
+
+    //! Textures by texture unit
+    std::vector<GLuint> textureUnits;
+};
+
+#endif
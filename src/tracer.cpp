@@ -0,0 +1,106 @@
+#include "tracer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+
+#include <GL/glew.h>
+
+namespace
+{
+    //! Thread counter, thread initializing tracer is the first one
+    std::atomic<int> threads = 0;
+
+    int currentThread()
+    {
+        thread_local int thread = threads++;
+        return thread;
+    }
+}
+
+void Tracer::init(size_t capacity)
+{
+    this->events.resize(capacity);
+    this->next = 0;
+    this->startTime = 0;
+    this->startTime = this->now();
+    currentThread();
+}
+
+bool Tracer::isEnabled()
+{
+    return !this->events.empty();
+}
+
+int64_t Tracer::now()
+{
+    if(this->events.empty())
+        return 0;
+
+    auto time = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count() - this->startTime;
+}
+
+void Tracer::calibrate()
+{
+    GLint64 gpuTime;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    this->gpuOffset = this->now() - gpuTime;
+}
+
+void Tracer::record(const char *name, int64_t begin, int index)
+{
+    if(this->events.empty())
+        return;
+
+    auto end = this->now();
+    auto position = this->next.fetch_add(1, std::memory_order_relaxed);
+
+    if(position < this->events.size())
+        this->events[position] = {name, begin, end, currentThread(), index};
+}
+
+void Tracer::recordGpu(const char *name, GLuint64 begin, GLuint64 end, int index)
+{
+    if(this->events.empty())
+        return;
+
+    auto position = this->next.fetch_add(1, std::memory_order_relaxed);
+
+    if(position < this->events.size())
+        this->events[position] = {name, (int64_t) begin + this->gpuOffset, (int64_t) end + this->gpuOffset, gpuThread, index};
+}
+
+void Tracer::write(const std::string &filename)
+{
+    auto file = fopen(filename.c_str(), "w");
+    if(file == nullptr)
+        throw std::runtime_error("Failed to open trace file");
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", gpuThread);
+
+    auto count = std::min(this->next.load(), this->events.size());
+    for(size_t i = 0; i < count; i++)
+    {
+        auto const& event = this->events[i];
+
+        fprintf(file, ",\n{\"name\":\"%s", event.name);
+        if(event.index >= 0)
+            fprintf(file, "_%d", event.index);
+        fprintf(file, "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.thread == gpuThread ? "gpu" : "cpu", event.thread, event.begin / 1000.0, (event.end - event.begin) / 1000.0);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+void Tracer::destroy()
+{
+    this->events.clear();
+    this->events.shrink_to_fit();
+    this->next = 0;
+}
@@ -0,0 +1,89 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <GL/glew.h>
+
+struct TraceEvent
+{
+    //! Name of the span, has to be a string literal
+    const char *name;
+
+    //! Begin of the span in nanoseconds
+    int64_t begin;
+
+    //! End of the span in nanoseconds
+    int64_t end;
+
+    //! Thread (track) of the span
+    int thread;
+
+    //! Index of the program appended to the name, -1 if none
+    int index;
+};
+
+class Tracer
+{
+public:
+    /*!
+     * @brief Allocate event buffer and start tracing
+     * @param capacity Maximum number of recorded events
+     */
+    void init(size_t capacity = 1 << 20);
+
+    //! Whether the tracer is initialized
+    bool isEnabled();
+
+    //! Get current time in nanoseconds since the tracer initialization
+    int64_t now();
+
+    //! Compute offset between GPU and CPU clock, needs current OpenGL context
+    void calibrate();
+
+    /*!
+     * @brief Record CPU span on the calling thread
+     * @param name Name of the span, has to be a string literal
+     * @param begin Begin of the span returned by now()
+     * @param index Index of the program, -1 if the span does not belong to program
+     */
+    void record(const char *name, int64_t begin, int index = -1);
+
+    /*!
+     * @brief Record GPU span
+     * @param name Name of the span, has to be a string literal
+     * @param begin GPU timestamp of the span begin
+     * @param end GPU timestamp of the span end
+     * @param index Index of the program, -1 if the span does not belong to program
+     */
+    void recordGpu(const char *name, GLuint64 begin, GLuint64 end, int index = -1);
+
+    /*!
+     * @brief Write recorded events in Trace Event Format
+     * @param filename Path to the output file
+     */
+    void write(const std::string &filename);
+
+    //! Free event buffer and stop tracing
+    void destroy();
+
+    //! Thread (track) of the GPU spans
+    static const int gpuThread = 1000;
+private:
+    //! Preallocated event buffer
+    std::vector<TraceEvent> events;
+
+    //! Position of the next event, events over capacity are dropped
+    std::atomic<size_t> next = 0;
+
+    //! Time of the tracer initialization
+    int64_t startTime = 0;
+
+    //! Offset added to GPU timestamps to get tracer time
+    int64_t gpuOffset = 0;
+};
+
+#endif
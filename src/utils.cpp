@@ -1,5 +1,6 @@
 #include "utils.hpp"
 
+#include <fstream>
 #include <stdexcept>
 
 GLsizei Utils::getTypeSize(GLenum type)
@@ -114,4 +115,30 @@ std::tuple<GLint, GLenum> Utils::getTypeFormat(GLenum type)
         return std::make_tuple(2, GL_BOOL);
     else
         throw std::runtime_error("Unsupported GLSL type");
+}
+
+uint64_t Utils::hash(const std::string &data, uint64_t seed)
+{
+    for(auto character : data)
+    {
+        seed ^= static_cast<unsigned char>(character);
+        seed *= 1099511628211ull;
+    }
+
+    return seed;
+}
+
+std::string Utils::readFile(const std::string &filename)
+{
+    std::ifstream stream(filename, std::ios::binary);
+
+    if(stream.fail())
+        throw std::invalid_argument("Could not open specified shader file");
+
+    std::string source;
+    stream.seekg(0, std::ios::end);
+    source.resize(stream.tellg());
+    stream.seekg(0, std::ios::beg);
+    stream.read(source.data(), source.size());
+    return source;
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 #define UTILS_H
 
 #include <tuple>
+#include <string>
+#include <cstdint>
 
 #include <GL/glew.h>
 
@@ -22,6 +24,21 @@ public:
      * @return Tuple where first item represents number of variables of type from second item
      */
     static std::tuple<GLint, GLenum> getTypeFormat(GLenum type);
+
+    /*!
+     * @brief Compute 64-bit FNV-1a hash of data
+     * @param data Hashed data
+     * @param seed Hash of the previous data, allows hashing data in parts
+     * @return Hash of the data
+     */
+    static uint64_t hash(const std::string &data, uint64_t seed = 14695981039346656037ull);
+
+    /*!
+     * @brief Read whole file
+     * @param filename Path to the file
+     * @return Contents of the file
+     */
+    static std::string readFile(const std::string &filename);
 };
 
 #endif
\ No newline at end of file